@@ -2,9 +2,46 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <cstdio>
 
 #include "bench.hpp"
 
+bool bench_arena_mmap = false;
+uint32_t bench_policy = NB_POLICY_FIRST_FIT;
+uint32_t bench_combining = NB_COMBINE_OFF;
+
+#if NB_INSTRUMENT
+/* Upper bound of the bucket that holds the quantile */
+static uint64_t hist_quantile(uint32_t hist, double q)
+{
+        uint64_t buckets[NB_HIST_BUCKETS];
+        uint64_t total = 0;
+
+        nb_stat_histogram(hist, buckets);
+        for (uint64_t count : buckets) {
+                total += count;
+        }
+
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < NB_HIST_BUCKETS; i++) {
+                seen += buckets[i];
+                if (total && q * total <= seen) {
+                        return i ? (1ULL << i) - 1 : 0;
+                }
+        }
+
+        return 0;
+}
+
+static void hist_print(const char *name, uint32_t hist)
+{
+        std::cout << "\t" << name << ": p50 <= " << hist_quantile(hist, 0.5)
+                  << ", p99 <= " << hist_quantile(hist, 0.99)
+                  << ", p99.9 <= " << hist_quantile(hist, 0.999)
+                  << ", max <= " << hist_quantile(hist, 1.0) << std::endl;
+}
+#endif
+
 void show_help() {
     std::cout << "Usage: ./bench [benchmark] [options]\n"
               << "Benchmarks:\n"
@@ -13,10 +50,20 @@ void show_help() {
               << "   --free-rnd,        Run random free benchmark\n"
               << "   --free-seq,        Run sequential free benchmark\n"
               << "   --stress,          Run stress test\n"
+              << "   --frag,            Run fragmentation benchmark (single-threaded)\n"
+              << "   --color,           Run page coloring benchmark (single-threaded)\n"
+              << "   --replay FILE,     Replay a trace of nb_trace_dump (multi-threaded)\n"
               << "\n"
               << "Options:\n"
               << "   --multi,           Multi-threaded\n"
               << "   --threads N,       Thread count (default: 4)\n"
+              << "   --mmap,            Reserve the arena with nb_init_mmap\n"
+              << "   --policy P,        Placement policy: first-fit, huge-pack,\n"
+              << "                      best-fit, partition\n"
+              << "   --combining M,     Flat combining: off (default), on, auto\n"
+#if NB_TRACE
+              << "   --trace FILE,      Record the benchmark into a trace\n"
+#endif
               << "   --duration S,      Duration for the benchmark (default: 30)\n"
               << "   --output FILE,     Output file (default: results.txt)\n"
               << "   --help,            Show this help message\n"
@@ -33,6 +80,8 @@ int main(int argc, char *argv[])
         /* Default values */
         std::string benchmark = "latency";
         std::string output = "results.txt";
+        std::string replay = "";
+        std::string trace = "";
 
         bool is_multi = false;
 
@@ -45,10 +94,58 @@ int main(int argc, char *argv[])
         for (size_t i = 0; i < args.size(); i++) {
                 if (args[i] == "--alloc-rnd" || args[i] == "--alloc-seq" ||
                     args[i] == "--free-rnd" || args[i] == "--free-seq" ||
-                    args[i] == "--latency" || args[i] == "--stress") {
+                    args[i] == "--latency" || args[i] == "--stress" ||
+                    args[i] == "--frag" || args[i] == "--color") {
                         benchmark = args[i].substr(2);
+                } else if (args[i] == "--replay") {
+                        if (i + 1 < args.size()) {
+                                benchmark = "replay";
+                                replay = args[++i];
+                        } else {
+                                std::cerr << "Error: --replay requires a file name" << std::endl;
+                                return 1;
+                        }
+#if NB_TRACE
+                } else if (args[i] == "--trace") {
+                        if (i + 1 < args.size()) {
+                                trace = args[++i];
+                        } else {
+                                std::cerr << "Error: --trace requires a file name" << std::endl;
+                                return 1;
+                        }
+#endif
                 } else if (args[i] == "--multi") {
                         is_multi = true;
+                } else if (args[i] == "--mmap") {
+                        bench_arena_mmap = true;
+                } else if (args[i] == "--policy") {
+                        std::string policy = i + 1 < args.size() ?
+                                args[++i] : "";
+                        if (policy == "first-fit") {
+                                bench_policy = NB_POLICY_FIRST_FIT;
+                        } else if (policy == "huge-pack") {
+                                bench_policy = NB_POLICY_HUGE_PACK;
+                        } else if (policy == "best-fit") {
+                                bench_policy = NB_POLICY_BEST_FIT;
+                        } else if (policy == "partition") {
+                                bench_policy = NB_POLICY_PARTITION;
+                        } else {
+                                std::cerr << "Error: unknown --policy " << policy << std::endl;
+                                return 1;
+                        }
+                } else if (args[i] == "--combining") {
+                        std::string mode = i + 1 < args.size() ?
+                                args[++i] : "";
+                        if (mode == "off") {
+                                bench_combining = NB_COMBINE_OFF;
+                        } else if (mode == "on") {
+                                bench_combining = NB_COMBINE_ON;
+                        } else if (mode == "auto") {
+                                bench_combining = NB_COMBINE_AUTO;
+                        } else {
+                                std::cerr << "Error: unknown --combining " << mode << std::endl;
+                                return 1;
+                        }
                 } else if (args[i] == "--threads") {
                          if (i + 1 < args.size()) {
                                 tc = std::stoul(args[++i]);
@@ -82,7 +179,10 @@ int main(int argc, char *argv[])
 
         /* Verbose */
         std::cout << "Running '" << benchmark << "' with options:\n"
-                  << "\tMulti-threaded: " << is_multi << "\n";
+                  << "\tMulti-threaded: " << is_multi << "\n"
+                  << "\tArena mmap: " << bench_arena_mmap << "\n"
+                  << "\tPolicy: " << bench_policy << "\n"
+                  << "\tCombining: " << bench_combining << "\n";
         if (is_multi) {
                 std::cout << "\tThread: " << tc << "\n";
         }
@@ -93,6 +193,10 @@ int main(int argc, char *argv[])
         std::ofstream ofs(output, std::ios::out | std::ios::binary);
         int res = 0;
 
+#if NB_TRACE
+        nb_set_trace(!trace.empty());
+#endif
+
         if (benchmark == "alloc-rnd") {
                 res = is_multi ? alloc_rnd_multi(ofs, dur, tc):
                         alloc_rnd_single(ofs, dur);
@@ -108,11 +212,54 @@ int main(int argc, char *argv[])
         } else if (benchmark == "stress") {
                 res = is_multi ? stress_multi(ofs, dur, tc):
                         stress_single(ofs, dur);
+        } else if (benchmark == "frag") {
+                res = frag_single(ofs, dur);
+        } else if (benchmark == "color") {
+                res = color_single(ofs, dur);
+        } else if (benchmark == "replay") {
+                res = replay_multi(ofs, replay);
         } else {
                 std::cerr << "Unknown benchmark: " << benchmark << std::endl;
                 res = 1;
         }
-        
+
+#if NB_TRACE
+        if (!trace.empty()) {
+                nb_set_trace(0);
+
+                FILE *file = fopen(trace.c_str(), "wb");
+                if (!file || nb_trace_dump(fileno(file))) {
+                        std::cerr << "Trace dump fail: " << trace << std::endl;
+                        res = 1;
+                } else {
+                        std::cout << "Trace saved to: " << trace << std::endl;
+                }
+                if (file) {
+                        fclose(file);
+                }
+        }
+#endif
+
+        /* Where the threads fought */
+        std::cout << "CAS failures: occupy "
+                  << nb_stat_cas_failures(NB_SITE_OCCUPY)
+                  << ", mark " << nb_stat_cas_failures(NB_SITE_MARK)
+                  << ", coalesce " << nb_stat_cas_failures(NB_SITE_COALESCE)
+                  << ", unmark " << nb_stat_cas_failures(NB_SITE_UNMARK)
+                  << std::endl;
+        std::cout << "Combined operations: " << nb_stat_combined()
+                  << std::endl;
+
+#if NB_INSTRUMENT
+        std::cout << "Histograms:" << std::endl;
+        hist_print("alloc ticks", NB_HIST_ALLOC_TICKS);
+        hist_print("free ticks", NB_HIST_FREE_TICKS);
+        hist_print("scanned", NB_HIST_SCANNED);
+        hist_print("failed tries", NB_HIST_FAILURES);
+        hist_print("restarts", NB_HIST_RESTARTS);
+        hist_print("levels climbed", NB_HIST_CLIMBED);
+#endif
+
         if (!res) {
                 /* Write to file */
                 ofs.flush();
@@ -4,6 +4,10 @@
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 
 #include "nbbs.h"
 
@@ -22,30 +26,109 @@
 #define BENCH_STRESS_UPPER 0.95f /* Percent */
 #define BENCH_STRESS_LOWER 0.05f /* Percent */
 #define BENCH_STRESS_PERIOD 100 /* Millisecond */
+#define BENCH_FRAG_ARENA_SIZE (256ULL * 1024 * 1024) /* Bytes */
+#define BENCH_FRAG_UPPER 0.90f /* Ratio */
+#define BENCH_FRAG_LOWER 0.80f /* Ratio */
+#define BENCH_COLOR_BUFFERS 64U /* Streamed side by side */
+
+/* Reserve the arena with nb_init_mmap() instead of std::aligned_alloc() */
+extern bool bench_arena_mmap;
+
+/* Placement policy passed to nb_set_policy() */
+extern uint32_t bench_policy;
+
+/* Flat combining mode passed to nb_set_combining() */
+extern uint32_t bench_combining;
 
 /*
  * bench_alloc_init()
  *
- * Creates arena for the allocator & initializes it.
+ * Creates arena (of size bytes) for the allocator & initializes it.
+ */
+static inline void bench_alloc_init(uint64_t size = BENCH_ARENA_SIZE)
+{
+        if (bench_arena_mmap) {
+                std::cout << "Initialize allocator (mmap)" << std::endl;
+                if (nb_init_mmap(size) != 0) {
+                        std::cerr << "Initialize allocator fail" << std::endl;
+                        std::exit(1);
+                }
+                std::cout << "Initialize allocator ok" << std::endl;
+        } else {
+                std::cout <<  "Initialize arena" << std::endl;
+                uint8_t *arena = (uint8_t*) std::aligned_alloc(
+                        BENCH_ARENA_ALIGN, size);
+                if (!arena) {
+                        std::cerr << "Initialize arena fail" << std::endl;
+                        std::exit(1);
+                }
+                std::cout <<  "Initialize arena ok" << std::endl;
+
+                /* Allocator init */
+                std::cout << "Initialize allocator" << std::endl;
+                if (nb_init((uint64_t) arena, size) != 0) {
+                        std::cerr << "Initialize allocator fail" << std::endl;
+                        std::exit(1);
+                }
+                std::cout << "Initialize allocator ok" << std::endl;
+        }
+
+        nb_set_policy(bench_policy);
+        nb_set_combining(bench_combining);
+
+        /* Back the arena with transparent huge pages (best effort) */
+        if (bench_policy == NB_POLICY_HUGE_PACK && nb_hugepage_advise()) {
+                std::cerr << "Huge page advise fail" << std::endl;
+        }
+}
+
+/*
+ * bench_trace_load()
+ *
+ * Reads a trace of nb_trace_dump() from path. Fills order with the events
+ * sorted by timestamp & deps with the allocation each free releases (-1 if
+ * it fell out of the ring). Returns a non-zero value if it's not a trace.
  */
-static inline void bench_alloc_init()
+static inline int bench_trace_load(const std::string& path,
+        nb_trace_header& header, std::vector<nb_trace_event>& events,
+        std::vector<uint64_t>& order, std::vector<int64_t>& deps)
 {
-        std::cout <<  "Initialize arena" << std::endl;
-        uint8_t *arena = (uint8_t*) std::aligned_alloc(
-                BENCH_ARENA_ALIGN, BENCH_ARENA_SIZE);
-        if (!arena) {
-                std::cerr << "Initialize arena fail" << std::endl;
-                std::exit(1);
+        std::ifstream ifs(path, std::ios::in | std::ios::binary);
+
+        if (!ifs.read((char*) &header, sizeof(header)) ||
+            header.magic != NB_TRACE_MAGIC) {
+                return 1;
+        }
+
+        nb_trace_event event;
+        while (ifs.read((char*) &event, sizeof(event))) {
+                events.push_back(event);
         }
-        std::cout <<  "Initialize arena ok" << std::endl;
 
-        /* Allocator init */
-        std::cout << "Initialize allocator" << std::endl;
-        if (nb_init((uint64_t) arena, BENCH_ARENA_SIZE) != 0) {
-                std::cerr << "Initialize allocator fail" << std::endl;
-                std::exit(1);
+        order.resize(events.size());
+        for (uint64_t i = 0; i < events.size(); i++) {
+                order[i] = i;
         }
-        std::cout << "Initialize allocator ok" << std::endl;
+        std::stable_sort(order.begin(), order.end(),
+                [&events](uint64_t a, uint64_t b) {
+                        return events[a].ticks < events[b].ticks;
+                });
+
+        /* Match every free with the last allocation of its block */
+        deps.assign(events.size(), -1);
+        std::unordered_map<uint64_t, uint64_t> live = {};
+        for (uint64_t i : order) {
+                if (events[i].op == NB_TRACE_ALLOC) {
+                        if (events[i].block != NB_INVALID_OFFSET) {
+                                live[events[i].block] = i;
+                        }
+                } else if (live.count(events[i].block)) {
+                        deps[i] = live[events[i].block];
+                        live.erase(events[i].block);
+                }
+        }
+
+        return 0;
 }
 
 /*
@@ -73,3 +156,8 @@ int free_seq_single(std::ofstream& ofs);
 int stress_multi(std::ofstream& ofs, unsigned dur, unsigned tc);
 int stress_single(std::ofstream& ofs, unsigned dur);
 
+int frag_single(std::ofstream& ofs, unsigned dur);
+int color_single(std::ofstream& ofs, unsigned dur);
+
+int replay_multi(std::ofstream& ofs, const std::string& path);
+
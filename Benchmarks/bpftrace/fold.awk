@@ -0,0 +1,19 @@
+#!/usr/bin/awk -f
+#
+# Folds the output of stress.bt into the results.txt layout of graph.py:
+#
+#   awk -f fold.awk trace.txt > results.txt && python3 ../graph.py
+#
+$2 == "alloc" || $2 == "free" {
+        if (!($1 in ops)) {
+                tids[n++] = $1;
+        }
+        ops[$1] = ops[$1] $2 " (" $3 "us, " $4 "%), ";
+}
+
+END {
+        print "stress_multi";
+        for (i = 0; i < n; i++) {
+                print "thread" i ": " ops[tids[i]];
+        }
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+
+#include "bench.hpp"
+
+/*
+ * Streams over BENCH_COLOR_BUFFERS single page buffers side by side, once
+ * with all of them on the same color & once with round-robin colors. The
+ * former maps every buffer to the same cache sets.
+ */
+static double stream(std::ofstream& ofs, const char *name, uint32_t color,
+        unsigned dur)
+{
+        std::vector<uint64_t*> bufs = {};
+        uint64_t words = nb_stat_min_size() / sizeof(uint64_t);
+
+        for (unsigned i = 0; i < BENCH_COLOR_BUFFERS; i++) {
+                uint64_t *buf = (uint64_t*) nb_alloc_colored(
+                        nb_stat_min_size(), color);
+                if (!buf) {
+                        std::cerr << FUNC_NAME << ": nb_alloc_colored fail."
+                                  << std::endl;
+                        break;
+                }
+
+                for (uint64_t w = 0; w < words; w++) {
+                        buf[w] = w;
+                }
+                bufs.push_back(buf);
+        }
+
+        uint64_t passes = 0;
+        uint64_t sum = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        auto end = start + std::chrono::seconds(dur);
+
+        while (std::chrono::high_resolution_clock::now() < end) {
+                /* Line by line, across all the buffers */
+                for (uint64_t w = 0; w < words; w += 8) {
+                        for (uint64_t *buf : bufs) {
+                                sum += buf[w];
+                                buf[w] = sum;
+                        }
+                }
+                passes++;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+        double ns = (double) elapsed / (passes * bufs.size() * words / 8);
+
+        std::cout << FUNC_NAME << ": " << name << ": " << std::fixed
+                  << std::setprecision(3) << ns << " ns/line (" << passes
+                  << " passes, checksum " << sum % 10 << ")" << std::endl;
+        ofs << name << ": " << std::fixed << std::setprecision(3)
+            << ns << " ns/line, " << passes << " passes\n";
+
+        for (uint64_t *buf : bufs) {
+                BENCH_FREE(buf);
+        }
+
+        return ns;
+}
+
+int color_single(std::ofstream& ofs, unsigned dur)
+{
+        ofs << FUNC_NAME << "\n";
+
+        bench_alloc_init(BENCH_FRAG_ARENA_SIZE);
+
+        /* Colors only follow physical addresses within a huge page */
+        if (nb_hugepage_advise()) {
+                std::cerr << "Huge page advise fail" << std::endl;
+        }
+
+        std::cout << FUNC_NAME << ": start" << std::endl;
+
+        unsigned half = dur < 2 ? 1 : dur / 2;
+        double same = stream(ofs, "same color", 0, half);
+        double colored = stream(ofs, "round-robin", NB_COLOR_NEXT, half);
+
+        std::cout << FUNC_NAME << ": done" << std::endl;
+        std::cout << FUNC_NAME << ": speedup: " << std::fixed
+                  << std::setprecision(2) << same / colored << "x"
+                  << std::endl;
+        ofs << "speedup: " << same / colored << "x\n";
+
+        return 0;
+}
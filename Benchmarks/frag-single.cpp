@@ -0,0 +1,116 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iomanip>
+
+#include "bench.hpp"
+
+/*
+ * Keeps the usage between BENCH_FRAG_LOWER and BENCH_FRAG_UPPER with small
+ * allocations & random frees. Every BENCH_BATCH_SIZE operations a max order
+ * block is requested; its failure rate measures the fragmentation.
+ */
+int frag_single(std::ofstream& ofs, unsigned dur)
+{
+        ofs << FUNC_NAME << "\n";
+
+        bench_alloc_init(BENCH_FRAG_ARENA_SIZE);
+
+        std::random_device rd;
+        std::mt19937 rng{rd()};
+        /* Smaller blocks are more common */
+        std::geometric_distribution<> dis(0.5);
+
+        std::vector<void*> allocs = {};
+        auto target = BENCH_FRAG_UPPER;
+        bool warm = false;
+
+        uint64_t ops = 0;
+        uint64_t probes = 0;
+        uint64_t failed = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::cout << FUNC_NAME << ": start" << std::endl;
+
+        ofs << "thread0: ";
+        for (;;) {
+                auto now = std::chrono::high_resolution_clock::now();
+                auto elapsed = std::chrono::duration_cast
+                        <std::chrono::seconds>(now - start).count();
+                if (dur < elapsed) {
+                        break;
+                }
+
+                float usage = (float) nb_stat_used_memory() /
+                        nb_stat_total_memory();
+
+                /* Alloc or free */
+                if (usage < target) {
+                        uint32_t order = dis(rng);
+                        if (nb_stat_max_order() <= order) {
+                                order = nb_stat_max_order() - 1;
+                        }
+
+                        void *ptr = BENCH_MALLOC(nb_stat_block_size(order));
+                        if (ptr) {
+                                allocs.push_back(ptr);
+                        } else {
+                                target = BENCH_FRAG_LOWER;
+                        }
+                } else if (allocs.size()) {
+                        std::uniform_int_distribution<size_t> pick(
+                                0, allocs.size() - 1);
+                        size_t i = pick(rng);
+
+                        BENCH_FREE(allocs[i]);
+                        allocs[i] = allocs.back();
+                        allocs.pop_back();
+                }
+
+                /* Memory usage check */
+                usage = (float) nb_stat_used_memory() /
+                        nb_stat_total_memory();
+                if (BENCH_FRAG_UPPER <= usage) {
+                        target = BENCH_FRAG_LOWER;
+                        warm = true;
+                } else if (usage < BENCH_FRAG_LOWER) {
+                        target = BENCH_FRAG_UPPER;
+                }
+
+                if (!warm || ++ops % BENCH_BATCH_SIZE) {
+                        continue;
+                }
+
+                /* Probe with a max order block */
+                std::cout << FUNC_NAME << ": elapsed: "
+                          << elapsed << " / " << dur << "\r" << std::flush;
+
+                uint64_t free_blocks = nb_stat_free_blocks(
+                        nb_stat_max_order());
+                void *ptr = BENCH_MALLOC(nb_stat_max_size());
+
+                probes++;
+                if (ptr) {
+                        BENCH_FREE(ptr);
+                } else {
+                        failed++;
+                }
+
+                ofs << std::fixed << std::setprecision(6)
+                    << "probe (" << usage * 100 << "%, " << free_blocks
+                    << ", " << (ptr ? "ok" : "fail") << "), ";
+        }
+        std::cout << "\n" << FUNC_NAME << ": done" << std::endl;
+
+        std::cout << FUNC_NAME << ": failed max order allocations: "
+                  << failed << " / " << probes << std::endl;
+        ofs << "\nfailed: " << failed << " / " << probes << "\n";
+
+        for (void *ptr : allocs) {
+                BENCH_FREE(ptr);
+        }
+
+        return 0;
+}
@@ -1,7 +1,7 @@
 import argparse
 from random import randint
 
-from numpy import arange, linspace, pi, sin
+from numpy import arange, linspace, nan, pi, sin
 
 from bokeh.layouts import column
 from bokeh.models import (CustomJS, LinearAxis, Range1d, Select,
@@ -42,12 +42,19 @@ def stress_multi_graph(threads : list):
     p.add_layout(LinearAxis(y_range_name="memory_usages", axis_label="Memory Usages (%)"), "right")
     p.line(time_points, memory_usages, legend_label="Memory Usage (%)", line_width=2, color="green", y_range_name="memory_usages")
 
-    # Draw latencies for each thread
+    # Draw latencies for each thread; refusals have none & break the line
     for idx, thread in enumerate(threads):
         for operation in thread:
             latencies.append(operation[0])
-        p.line(time_points, latencies[:len(time_points)], legend_label=f"Latencies (us) - Thread {idx}", line_width=1, color=random_color())
-        
+        color = random_color()
+        p.line(time_points, latencies[:len(time_points)], legend_label=f"Latencies (us) - Thread {idx}", line_width=1, color=color)
+
+        # Refused allocations (low watermark), at the memory usage they saw
+        refused = [i for i, operation in enumerate(thread[:len(time_points)]) if operation[2]]
+        if refused:
+            p.scatter([time_points[i] for i in refused], [thread[i][1] * 100 for i in refused],
+                      legend_label=f"Refused - Thread {idx}", marker="x", size=8, color=color, y_range_name="memory_usages")
+
         latencies.clear()
 
     # Plot configuration
@@ -79,10 +86,18 @@ if __name__ == "__main__":
             operations = line[(line.find(":")) + 1: ].split("), ")
 
             for operation in operations:
-                latency = int(operation[operation.find("(") +1: operation.find("us")])
+                operation = operation.strip()
+
+                # e.g. "refused (97.5%" from stress-multi; no latency
+                if operation.startswith("refused"):
+                    mem_usage = float(operation[operation.find("(") +1: operation.find("%")])
+                    threads[-1].append([nan, mem_usage, True])
+                    continue
+
+                latency = int(operation[operation.find("(") +1: operation.find("us,")])
                 mem_usage = float(operation[operation.find(",") +2: operation.find("%")])
 
-                threads[-1].append([latency, mem_usage])
+                threads[-1].append([latency, mem_usage, False])
 
     # 3. Call the corresponding function
     stress_multi_graph(threads)
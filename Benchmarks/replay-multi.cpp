@@ -0,0 +1,225 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <iomanip>
+
+#include "bench.hpp"
+
+/* Replay state of an allocation; its free waits until it's done */
+struct replay_slot {
+        std::atomic<bool> done{false};
+        void *addr = nullptr;
+};
+
+struct replay_lats {
+        std::vector<uint64_t> alloc = {}; /* ns */
+        std::vector<uint64_t> free = {}; /* ns */
+        uint64_t failed = 0; /* recorded ones that succeeded */
+
+        /* Sampled every BENCH_BATCH_SIZE events */
+        uint64_t peak = 0; /* bytes */
+        double peak_frag = 0.0;
+};
+
+/* Share of the free memory that is not in max order blocks */
+static double replay_frag()
+{
+        uint64_t free_memory = nb_stat_total_memory() - nb_stat_used_memory();
+        uint64_t free_max = nb_stat_free_blocks(nb_stat_max_order()) *
+                nb_stat_max_size();
+
+        return free_memory ? 1.0 - (double) free_max / free_memory : 0.0;
+}
+
+/* Events of one recorded thread, in their own order */
+static void replay_multi_runner(const std::vector<nb_trace_event>& events,
+        const std::vector<uint64_t>& mine, const std::vector<int64_t>& deps,
+        std::vector<replay_slot>& slots, replay_lats& lats)
+{
+        uint64_t ops = 0;
+
+        for (uint64_t i : mine) {
+                const nb_trace_event &event = events[i];
+
+                if (++ops % BENCH_BATCH_SIZE == 0) {
+                        uint64_t used = nb_stat_used_memory();
+                        if (lats.peak < used) {
+                                lats.peak = used;
+                                lats.peak_frag = replay_frag();
+                        }
+                }
+
+                if (event.op == NB_TRACE_ALLOC) {
+                        auto start = std::chrono::high_resolution_clock::now();
+                        void *ptr = nb_alloc_flags(event.size, event.flags);
+                        auto durr = std::chrono::high_resolution_clock::now() - start;
+
+                        if (!ptr && event.block != NB_INVALID_OFFSET) {
+                                lats.failed++;
+                        }
+
+                        lats.alloc.push_back(std::chrono::duration_cast
+                                <std::chrono::nanoseconds>(durr).count());
+                        slots[i].addr = ptr;
+                        slots[i].done.store(true, std::memory_order_release);
+                        continue;
+                }
+
+                /* Its allocation fell out of the ring */
+                if (deps[i] < 0) {
+                        continue;
+                }
+
+                replay_slot &alloc = slots[deps[i]];
+                while (!alloc.done.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+                BENCH_FREE(alloc.addr);
+                auto durr = std::chrono::high_resolution_clock::now() - start;
+
+                lats.free.push_back(std::chrono::duration_cast
+                        <std::chrono::nanoseconds>(durr).count());
+                alloc.addr = nullptr;
+        }
+}
+
+static void replay_print(std::ofstream& ofs, const char *name,
+        std::vector<uint64_t>& lats)
+{
+        if (lats.empty()) {
+                return;
+        }
+
+        std::sort(lats.begin(), lats.end());
+        auto at = [&lats](double q) {
+                return lats[(uint64_t) (q * (lats.size() - 1))];
+        };
+
+        std::cout << FUNC_NAME << ": " << name << ": " << lats.size()
+                  << " ops, p50 " << at(0.5) << "ns, p99 " << at(0.99)
+                  << "ns, p99.9 " << at(0.999) << "ns, max " << lats.back()
+                  << "ns" << std::endl;
+        ofs << name << ": " << lats.size() << ", " << at(0.5) << "ns, "
+            << at(0.99) << "ns, " << at(0.999) << "ns, " << lats.back()
+            << "ns\n";
+}
+
+/*
+ * Replays a trace of nb_trace_dump(). Each recorded thread gets a thread,
+ * and a free waits for the allocation it releases, which may be on another
+ * thread. The order across threads follows the recorded timestamps.
+ */
+int replay_multi(std::ofstream& ofs, const std::string& path)
+{
+        ofs << FUNC_NAME << "\n";
+
+        nb_trace_header header;
+        std::vector<nb_trace_event> events = {};
+        std::vector<uint64_t> order = {};
+        std::vector<int64_t> deps = {};
+
+        if (bench_trace_load(path, header, events, order, deps)) {
+                std::cerr << FUNC_NAME << ": not a trace: " << path
+                          << std::endl;
+                return 1;
+        }
+
+        std::cout << FUNC_NAME << ": " << events.size() << " events, "
+                  << header.total_memory << " bytes, min size "
+                  << header.min_size << ", max order " << header.max_order
+                  << ", policy " << header.policy << std::endl;
+        if (header.min_size != nb_stat_min_size() ||
+            header.max_order != nb_stat_max_order()) {
+                std::cerr << FUNC_NAME << ": recorded with another "
+                          << "NB_MIN_SIZE/NB_MAX_ORDER" << std::endl;
+        }
+
+        std::map<uint32_t, std::vector<uint64_t>> threads = {};
+        for (uint64_t i = 0; i < events.size(); i++) {
+                threads[events[i].thread].push_back(i);
+        }
+
+        uint64_t size = (header.total_memory + BENCH_ARENA_ALIGN - 1) /
+                BENCH_ARENA_ALIGN * BENCH_ARENA_ALIGN;
+        bench_alloc_init(size);
+
+        std::vector<replay_slot> slots(events.size());
+        std::vector<replay_lats> lats(threads.size());
+        std::vector<std::thread> runners = {};
+
+        std::cout << FUNC_NAME << ": start (" << threads.size()
+                  << " threads)" << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        uint32_t t = 0;
+        for (auto &[id, mine] : threads) {
+                runners.push_back(std::thread(replay_multi_runner,
+                        std::cref(events), std::cref(mine), std::cref(deps),
+                        std::ref(slots), std::ref(lats[t++])));
+        }
+        for (std::thread &runner : runners) {
+                runner.join();
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << FUNC_NAME << ": done (" << elapsed << "ms)"
+                  << std::endl;
+
+        /* Latencies over all threads */
+        replay_lats all;
+        for (replay_lats &lat : lats) {
+                if (all.peak < lat.peak) {
+                        all.peak = lat.peak;
+                        all.peak_frag = lat.peak_frag;
+                }
+                all.alloc.insert(all.alloc.end(), lat.alloc.begin(),
+                        lat.alloc.end());
+                all.free.insert(all.free.end(), lat.free.begin(),
+                        lat.free.end());
+                all.failed += lat.failed;
+        }
+        replay_print(ofs, "alloc", all.alloc);
+        replay_print(ofs, "free", all.free);
+
+        /* At the peak & of what's left at the end */
+        double frag = replay_frag();
+
+        std::cout << FUNC_NAME << ": failed allocations: " << all.failed
+                  << std::endl;
+        std::cout << FUNC_NAME << ": peak: " << all.peak << " bytes, "
+                  << std::fixed << std::setprecision(2)
+                  << all.peak_frag * 100 << "% fragmented" << std::endl;
+        std::cout << FUNC_NAME << ": end: " << nb_stat_used_memory()
+                  << " bytes, " << frag * 100 << "% fragmented" << std::endl;
+        ofs << "failed: " << all.failed << "\n"
+            << "peak: " << all.peak << ", " << all.peak_frag * 100 << "%\n"
+            << "end: " << nb_stat_used_memory() << ", " << frag * 100
+            << "%\n"
+            << "free blocks: ";
+
+        std::cout << FUNC_NAME << ": free blocks:";
+        for (uint32_t o = 0; o <= nb_stat_max_order(); o++) {
+                std::cout << " " << nb_stat_free_blocks(o);
+                ofs << nb_stat_free_blocks(o) << " ";
+        }
+        std::cout << std::endl;
+        ofs << "\n";
+
+        /* Never freed within the trace */
+        for (replay_slot &slot : slots) {
+                if (slot.addr) {
+                        BENCH_FREE(slot.addr);
+                }
+        }
+
+        return 0;
+}
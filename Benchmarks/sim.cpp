@@ -0,0 +1,294 @@
+/*
+ * Trace driven simulator
+ *
+ * Replays a trace of nb_trace_dump() on a single thread, in timestamp order,
+ * against the tree logic of nbbs.c. The arena is never touched, so it sits
+ * at a fake address & can be of any size. NB_MIN_SIZE & NB_MAX_ORDER are
+ * fixed at build time (e.g. make sim MIN_SIZE=16384 MAX_ORDER=12); the
+ * placement policies are compared in one run.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+
+#include "bench.hpp"
+
+#define SIM_BASE (1ULL << 40) /* Never dereferenced */
+#define SIM_SAMPLES 10ULL /* Free block histograms over the trace */
+
+struct sim_policy {
+        const char *name;
+        uint32_t policy;
+};
+
+/* Partitions need several threads; one share is first fit */
+static const sim_policy sim_policies[] = {
+        {"first-fit", NB_POLICY_FIRST_FIT},
+        {"huge-pack", NB_POLICY_HUGE_PACK},
+        {"best-fit", NB_POLICY_BEST_FIT},
+};
+
+struct sim_result {
+        uint64_t allocs = 0;
+        uint64_t failed = 0;
+        uint64_t newly_failed = 0; /* succeeded when recorded */
+
+        uint64_t peak = 0; /* bytes in blocks */
+        uint64_t peak_requested = 0; /* bytes asked for, at the peak */
+
+        uint64_t requested = 0; /* over all allocations */
+        uint64_t granted = 0;
+
+        double secs = 0.0;
+};
+
+/* Block the allocator hands out for the request */
+static uint64_t sim_block_size(uint64_t size)
+{
+        uint64_t block = nb_stat_min_size();
+        while (block < size) {
+                block <<= 1;
+        }
+
+        return block;
+}
+
+static void sim_histogram(std::ofstream& ofs, const char *name, uint64_t at,
+        uint64_t used)
+{
+        ofs << name << " " << at << " " << std::fixed << std::setprecision(2)
+            << (double) used / nb_stat_total_memory() * 100 << "%:";
+        for (uint32_t o = 0; o <= nb_stat_max_order(); o++) {
+                ofs << " " << nb_stat_free_blocks(o);
+        }
+        ofs << "\n";
+}
+
+static int sim_run(std::ofstream& ofs, const sim_policy& policy,
+        const std::vector<nb_trace_event>& events,
+        const std::vector<uint64_t>& order, const std::vector<int64_t>& deps,
+        uint64_t memory, uint64_t samples, sim_result& res)
+{
+        if (nb_init(SIM_BASE, memory)) {
+                std::cerr << "Initialize allocator fail" << std::endl;
+                return 1;
+        }
+        nb_set_policy(policy.policy);
+        nb_set_combining(NB_COMBINE_OFF);
+
+        std::vector<void*> addrs(events.size(), nullptr);
+        uint64_t every = std::max(order.size() / samples, (size_t) 1);
+        uint64_t used = 0;
+        uint64_t requested = 0;
+        std::chrono::nanoseconds sampling{0};
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (uint64_t n = 0; n < order.size(); n++) {
+                uint64_t i = order[n];
+                const nb_trace_event &event = events[i];
+
+                if (event.op == NB_TRACE_ALLOC) {
+                        void *ptr = nb_alloc_flags(event.size, event.flags);
+
+                        res.allocs++;
+                        if (!ptr) {
+                                res.failed++;
+                                res.newly_failed +=
+                                        event.block != NB_INVALID_OFFSET;
+                        } else {
+                                addrs[i] = ptr;
+                                used += sim_block_size(event.size);
+                                requested += event.size;
+                                res.granted += sim_block_size(event.size);
+                                res.requested += event.size;
+                        }
+
+                        if (res.peak < used) {
+                                res.peak = used;
+                                res.peak_requested = requested;
+                        }
+                } else if (0 <= deps[i] && addrs[deps[i]]) {
+                        uint64_t size = events[deps[i]].size;
+
+                        nb_free(addrs[deps[i]]);
+                        addrs[deps[i]] = nullptr;
+                        used -= sim_block_size(size);
+                        requested -= size;
+                }
+
+                /* Scans the tree; kept out of the timing */
+                if (n % every == 0) {
+                        auto begin = std::chrono::high_resolution_clock::now();
+                        sim_histogram(ofs, policy.name, n, used);
+                        sampling += std::chrono::high_resolution_clock::now() -
+                                begin;
+                }
+        }
+
+        auto elapsed = std::chrono::high_resolution_clock::now() - start -
+                sampling;
+        res.secs = std::chrono::duration<double>(elapsed).count();
+
+        sim_histogram(ofs, policy.name, order.size(), used);
+
+        for (void *addr : addrs) {
+                nb_free(addr);
+        }
+
+        return 0;
+}
+
+static void sim_print(std::ostream& os, const char *name,
+        const sim_result& res, uint64_t ops)
+{
+        double failed = res.allocs ?
+                (double) res.failed / res.allocs * 100 : 0.0;
+        double peak_frag = res.peak ?
+                (1.0 - (double) res.peak_requested / res.peak) * 100 : 0.0;
+        double avg_frag = res.granted ?
+                (1.0 - (double) res.requested / res.granted) * 100 : 0.0;
+
+        os << std::left << std::setw(10) << name << std::right << std::fixed
+           << std::setprecision(3)
+           << " failed " << failed << "% (" << res.failed << ", "
+           << res.newly_failed << " new)"
+           << ", peak " << res.peak << " bytes"
+           << ", internal frag " << std::setprecision(2) << peak_frag
+           << "% at peak, " << avg_frag << "% overall"
+           << ", " << std::setprecision(0) << (res.secs ? ops / res.secs : 0)
+           << " ops/s" << std::endl;
+}
+
+void show_help() {
+    std::cout << "Usage: ./sim [options] TRACE\n"
+              << "Options:\n"
+              << "   --policy P,        Placement policy: first-fit, huge-pack,\n"
+              << "                      best-fit (default: all of them)\n"
+              << "   --memory BYTES,    Arena size (default: as recorded)\n"
+              << "   --samples N,       Free block histograms over the trace\n"
+              << "                      (default: 10)\n"
+              << "   --output FILE,     Output file (default: sim.txt)\n"
+              << "   --help,            Show this help message\n"
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc < 2) {
+                show_help();
+                return 1;
+        }
+
+        std::string path = "";
+        std::string output = "sim.txt";
+        std::string policy = "";
+        uint64_t memory = 0;
+        uint64_t samples = SIM_SAMPLES;
+
+        std::vector<std::string> args(argv + 1, argv + argc);
+
+        for (size_t i = 0; i < args.size(); i++) {
+                if (args[i] == "--policy") {
+                        policy = i + 1 < args.size() ? args[++i] : "";
+                } else if (args[i] == "--memory") {
+                        if (i + 1 < args.size()) {
+                                memory = std::stoull(args[++i]);
+                        } else {
+                                std::cerr << "Error: --memory requires a number" << std::endl;
+                                return 1;
+                        }
+                } else if (args[i] == "--samples") {
+                        if (i + 1 < args.size()) {
+                                samples = std::max(std::stoull(args[++i]),
+                                        1ULL);
+                        } else {
+                                std::cerr << "Error: --samples requires a number" << std::endl;
+                                return 1;
+                        }
+                } else if (args[i] == "--output") {
+                        if (i + 1 < args.size()) {
+                                output = args[++i];
+                        } else {
+                                std::cerr << "Error: --output requires a file name" << std::endl;
+                                return 1;
+                        }
+                } else if (args[i] == "--help") {
+                        show_help();
+                        return 0;
+                } else if (path.empty()) {
+                        path = args[i];
+                } else {
+                        std::cerr << "Unknown argument: " << args[i] << std::endl;
+                        show_help();
+                        return 1;
+                }
+        }
+
+        bool found = policy.empty();
+        for (const sim_policy &p : sim_policies) {
+                found |= policy == p.name;
+        }
+        if (!found) {
+                std::cerr << "Error: unknown --policy " << policy << std::endl;
+                return 1;
+        }
+
+        nb_trace_header header;
+        std::vector<nb_trace_event> events = {};
+        std::vector<uint64_t> order = {};
+        std::vector<int64_t> deps = {};
+
+        if (bench_trace_load(path, header, events, order, deps)) {
+                std::cerr << "Error: not a trace: " << path << std::endl;
+                return 1;
+        }
+
+        if (!memory) {
+                memory = header.total_memory;
+        }
+
+        std::ofstream ofs(output, std::ios::out | std::ios::binary);
+        ofs << "sim: " << events.size() << " events, " << memory
+            << " bytes, min size " << nb_stat_min_size() << ", max order "
+            << nb_stat_max_order() << "\n";
+
+        std::cout << "Simulating '" << path << "':\n"
+                  << "\tEvents: " << events.size() << "\n"
+                  << "\tRecorded: " << header.total_memory
+                  << " bytes, min size " << header.min_size
+                  << ", max order " << header.max_order << "\n"
+                  << "\tSimulated: " << memory << " bytes, min size "
+                  << nb_stat_min_size() << ", max order "
+                  << nb_stat_max_order() << "\n"
+                  << "\tOutput: " << output << std::endl;
+
+        for (const sim_policy &p : sim_policies) {
+                if (!policy.empty() && policy != p.name) {
+                        continue;
+                }
+
+                sim_result res;
+                if (sim_run(ofs, p, events, order, deps, memory, samples,
+                                res)) {
+                        return 1;
+                }
+
+                sim_print(std::cout, p.name, res, events.size());
+                sim_print(ofs, p.name, res, events.size());
+        }
+
+        /* Sized by the arena; the same for every policy */
+        std::cout << "Metadata: " << nb_stat_tree_size() +
+                nb_stat_index_size() << " bytes (tree " << nb_stat_tree_size()
+                  << ", index " << nb_stat_index_size() << ")" << std::endl;
+        ofs << "metadata: " << nb_stat_tree_size() + nb_stat_index_size()
+            << "\n";
+
+        return 0;
+}
@@ -11,6 +11,13 @@
 
 std::atomic<float> target = BENCH_STRESS_UPPER;
 
+/* Flip the direction once usage crosses the limits */
+static void stress_multi_watermark(uint32_t, uint32_t event, void*)
+{
+        target = event == NB_WMARK_LOW ? BENCH_STRESS_LOWER :
+                BENCH_STRESS_UPPER;
+}
+
 static void stress_multi_runner(std::ostringstream& os,
                                 std::vector<void*>& allocs, unsigned dur)
 {
@@ -40,11 +47,17 @@ static void stress_multi_runner(std::ostringstream& os,
                         void *ptr = (void*) BENCH_MALLOC(alloc_size);
                         auto durr = std::chrono::high_resolution_clock::now() - start;
 
-                        auto us = std::chrono::duration_cast
-                                <std::chrono::microseconds>(durr).count();
-                        os << "alloc (" << us << "us, " << usage << "%), ";
-
-                        allocs.push_back(ptr);
+                        /* Refused at the low watermark; flips the target */
+                        if (!ptr) {
+                                os << "refused (" << usage << "%), ";
+                        } else {
+                                auto us = std::chrono::duration_cast
+                                        <std::chrono::microseconds>(durr).count();
+                                os << "alloc (" << us << "us, " << usage
+                                   << "%), ";
+
+                                allocs.push_back(ptr);
+                        }
                 } else if (allocs.size()) {
                         void *addr = allocs.back();
 
@@ -71,6 +84,15 @@ int stress_multi(std::ofstream& ofs, unsigned dur, unsigned tc)
 
         bench_alloc_init();
 
+        /* Usage is in percent; watermarks are bytes of free memory */
+        uint64_t total = nb_stat_total_memory();
+        for (uint32_t i = 0; i <= nb_stat_max_order(); i++) {
+                nb_set_watermark(i,
+                        total - (uint64_t) (total * BENCH_STRESS_UPPER / 100),
+                        total - (uint64_t) (total * BENCH_STRESS_LOWER / 100));
+        }
+        nb_set_watermark_callback(stress_multi_watermark, 0);
+
         std::vector<std::vector<void*>> allocs(tc);
         std::vector<std::ostringstream> streams(tc);
         std::vector<std::thread> threads = {};
@@ -88,7 +110,7 @@ int stress_multi(std::ofstream& ofs, unsigned dur, unsigned tc)
                                 std::ref(allocs[i]), dur));
         }
 
-        /* Monitor memory usage */
+        /* Memory usage is monitored by the watermark callback */
         auto start = std::chrono::high_resolution_clock::now();
         std::cout << FUNC_NAME << ": main: start" << std::endl;
 
@@ -103,15 +125,6 @@ int stress_multi(std::ofstream& ofs, unsigned dur, unsigned tc)
                 std::cout << FUNC_NAME << ": main: elapsed: "
                           << elapsed << " / " << dur << "s\r" << std::flush;
 
-                /* Memory usage check */
-                float usage = (float) nb_stat_used_memory() /
-                        nb_stat_total_memory() * 100;
-                if (BENCH_STRESS_UPPER <= usage) {
-                        target = BENCH_STRESS_LOWER;
-                } else if (usage < BENCH_STRESS_LOWER) {
-                        target = BENCH_STRESS_UPPER;
-                }
-
                 std::this_thread::sleep_for(std::chrono::milliseconds(
                         BENCH_STRESS_PERIOD));
         }
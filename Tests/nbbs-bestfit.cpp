@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, bestfit)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        nb_set_policy(NB_POLICY_BEST_FIT);
+
+        uint64_t regions = nbbs_total_memory / nbbs_max_size;
+        EXPECT_EQ(regions, nb_stat_free_blocks(nbbs_max_order));
+        EXPECT_EQ(nbbs_total_memory / nbbs_min_size, nb_stat_free_blocks(0));
+        EXPECT_EQ(0ULL, nb_stat_free_blocks(nbbs_max_order + 1));
+
+        /* Pages 0-1, 2 & 3 */
+        void *pair = nb_alloc(2 * nbbs_min_size);
+        void *two = nb_alloc(nbbs_min_size);
+        void *three = nb_alloc(nbbs_min_size);
+        ASSERT_EQ((uint64_t) playground, (uint64_t) pair);
+        ASSERT_EQ((uint64_t) playground + 2 * nbbs_min_size, (uint64_t) two);
+        ASSERT_EQ((uint64_t) playground + 3 * nbbs_min_size, (uint64_t) three);
+        EXPECT_EQ(regions - 1, nb_stat_free_blocks(nbbs_max_order));
+
+        /* Holes: pages 0-1 (order 1) & page 3 (order 0) */
+        nb_free(pair);
+        nb_free(three);
+        uint64_t pairs = nbbs_max_size / (2 * nbbs_min_size);
+        EXPECT_EQ((regions - 1) * pairs + pairs - 1, nb_stat_free_blocks(1));
+
+        /* First fit would split the larger hole */
+        void *small = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground + 3 * nbbs_min_size, (uint64_t) small);
+
+        void *fit = nb_alloc(2 * nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground, (uint64_t) fit);
+
+        /* Region #0 whole, region #1 split */
+        nb_free(fit);
+        nb_free(small);
+        nb_free(two);
+        EXPECT_EQ(regions, nb_stat_free_blocks(nbbs_max_order));
+
+        void *whole = nb_alloc(nbbs_max_size);
+        void *first = nb_alloc(nbbs_min_size);
+        ASSERT_EQ((uint64_t) playground, (uint64_t) whole);
+        ASSERT_EQ((uint64_t) playground + nbbs_max_size, (uint64_t) first);
+        nb_free(whole);
+        EXPECT_EQ(regions - 1, nb_stat_free_blocks(nbbs_max_order));
+
+        /* Region #1 is preferred over the whole region #0 */
+        void *second = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground + nbbs_max_size + nbbs_min_size,
+                (uint64_t) second);
+        EXPECT_EQ(regions - 1, nb_stat_free_blocks(nbbs_max_order));
+
+        nb_free(second);
+        nb_free(first);
+        EXPECT_EQ(regions, nb_stat_free_blocks(nbbs_max_order));
+
+        /* Smallest hole in a later region; page 1 of region #2 */
+        void *front = nb_alloc(2 * nbbs_min_size);
+        ASSERT_EQ((uint64_t) playground, (uint64_t) front);
+        ASSERT_EQ(0, nb_reserve_range((uint64_t) playground +
+                2 * nbbs_max_size, nbbs_min_size));
+
+        void *page = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground + 2 * nbbs_max_size + nbbs_min_size,
+                (uint64_t) page);
+        nb_free(page);
+        nb_free(front);
+
+        nb_set_policy(NB_POLICY_FIRST_FIT);
+        std::free(playground);
+}
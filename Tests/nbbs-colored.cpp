@@ -0,0 +1,87 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+static uint64_t color_of(uint8_t *playground, void *addr)
+{
+        return ((uint64_t) addr - (uint64_t) playground) / nbbs_min_size %
+                NB_COLORS;
+}
+
+TEST(NBBS, colored)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Single pages */
+        void *seven = nb_alloc_colored(nbbs_min_size, 7);
+        ASSERT_NE((void*) 0, seven);
+        EXPECT_EQ(7ULL, color_of(playground, seven));
+        EXPECT_EQ((uint64_t) playground + 7 * nbbs_min_size, (uint64_t) seven);
+
+        void *again = nb_alloc_colored(nbbs_min_size, 7 + NB_COLORS);
+        EXPECT_EQ((uint64_t) playground + (7 + NB_COLORS) * nbbs_min_size,
+                (uint64_t) again);
+
+        /* Larger blocks start at the color rounded down to their size */
+        void *quad = nb_alloc_colored(4 * nbbs_min_size, 13);
+        ASSERT_NE((void*) 0, quad);
+        EXPECT_EQ(12ULL, color_of(playground, quad));
+
+        /* Blocks that span all colors are placed as usual */
+        void *max = nb_alloc_colored(nbbs_max_size, 5);
+        EXPECT_EQ((uint64_t) playground + nbbs_max_size, (uint64_t) max);
+
+        nb_free(seven);
+        nb_free(again);
+        nb_free(quad);
+        nb_free(max);
+
+        /* Round-robin */
+        std::vector<void*> allocs = {};
+        for (uint32_t i = 0; i < 2 * NB_COLORS; i++) {
+                allocs.push_back(nb_alloc_colored(nbbs_min_size,
+                        NB_COLOR_NEXT));
+                ASSERT_NE((void*) 0, allocs.back());
+        }
+
+        uint64_t first = color_of(playground, allocs[0]);
+        for (uint32_t i = 0; i < allocs.size(); i++) {
+                EXPECT_EQ((first + i) % NB_COLORS,
+                        color_of(playground, allocs[i]));
+                nb_free(allocs[i]);
+        }
+        allocs.clear();
+
+        /* A color runs out on its own */
+        uint64_t pages = nbbs_total_memory / nbbs_min_size / NB_COLORS;
+        for (uint64_t i = 0; i < pages; i++) {
+                allocs.push_back(nb_alloc_colored(nbbs_min_size, 3));
+                ASSERT_NE((void*) 0, allocs.back());
+                EXPECT_EQ(3ULL, color_of(playground, allocs.back()));
+        }
+        EXPECT_EQ((void*) 0, nb_alloc_colored(nbbs_min_size, 3));
+
+        void *other = nb_alloc_colored(nbbs_min_size, 4);
+        EXPECT_EQ(4ULL, color_of(playground, other));
+        nb_free(other);
+
+        for (void *alloc : allocs) {
+                nb_free(alloc);
+        }
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size,
+                nb_stat_free_blocks(nbbs_max_order));
+
+        std::free(playground);
+}
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, combining)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Off by default */
+        uint64_t combined = nb_stat_combined();
+        nb_free(nb_alloc(nbbs_min_size));
+        EXPECT_EQ(combined, nb_stat_combined());
+
+#if NB_INSTRUMENT
+        uint64_t buckets[NB_HIST_BUCKETS];
+        EXPECT_EQ(0, nb_stat_histogram(NB_HIST_SCANNED, buckets));
+        uint64_t unscanned = buckets[0];
+#endif
+
+        /* Every request goes through a combiner */
+        nb_set_combining(NB_COMBINE_ON);
+
+        std::vector<std::thread> threads = {};
+        for (int i = 0; i < nbbs_thread_count; i++) {
+                threads.push_back(std::thread([]() {
+                        for (int j = 0; j < nbbs_iter_count; j++) {
+                                void *alloc = nb_alloc(nbbs_min_size);
+                                ASSERT_NE((void*) 0, alloc);
+                                nb_free(alloc);
+                        }
+                }));
+        }
+
+        for (std::thread &thread : threads) {
+                thread.join();
+        }
+
+        EXPECT_EQ(combined + 2 * nbbs_thread_count * nbbs_iter_count,
+                nb_stat_combined());
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+
+#if NB_INSTRUMENT
+        /* Scans are counted for the requester, not the combiner */
+        EXPECT_EQ(0, nb_stat_histogram(NB_HIST_SCANNED, buckets));
+        EXPECT_EQ(unscanned, buckets[0]);
+#endif
+
+        /* Plain lock-free path */
+        nb_set_combining(NB_COMBINE_OFF);
+        combined = nb_stat_combined();
+        nb_free(nb_alloc(nbbs_min_size));
+        EXPECT_EQ(combined, nb_stat_combined());
+
+        /* Contended; a failed CAS per operation switches it on */
+        nb_set_combining(NB_COMBINE_AUTO);
+        void *block = nb_alloc(nbbs_max_size);
+        nb_node_t node = EXP2(nbbs_base_level);
+
+        for (uint32_t i = 0; i < NB_COMBINE_ENTER; i++) {
+                ASSERT_EQ(node, __nb_try_alloc(node));
+        }
+        for (uint32_t i = 0; i < NB_COMBINE_WINDOW; i++) {
+                nb_free(nb_alloc(nbbs_min_size));
+        }
+        EXPECT_LT(combined, nb_stat_combined());
+
+        /* Nobody to combine for; switches off again */
+        for (uint32_t i = 0; i < 2 * NB_COMBINE_WINDOW; i++) {
+                nb_free(nb_alloc(nbbs_min_size));
+        }
+
+        combined = nb_stat_combined();
+        nb_free(nb_alloc(nbbs_min_size));
+        EXPECT_EQ(combined, nb_stat_combined());
+
+        nb_free(block);
+        nb_set_combining(NB_COMBINE_OFF);
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size,
+                nb_stat_free_blocks(nbbs_max_order));
+
+        std::free(playground);
+}
@@ -0,0 +1,141 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+struct nbbs_compact_ctx {
+        std::vector<void*> *allocs;
+        uint32_t moved;
+        uint32_t refuse; /* moves left to refuse */
+};
+
+static int nbbs_relocate(void *dst, void *src, uint64_t size, void *ctx)
+{
+        auto *c = static_cast<nbbs_compact_ctx*>(ctx);
+
+        if (c->refuse) {
+                c->refuse--;
+                return 1;
+        }
+
+        memcpy(dst, src, size);
+        for (auto &alloc : *c->allocs) {
+                if (alloc == src) {
+                        alloc = dst;
+                }
+        }
+        c->moved++;
+
+        return 0;
+}
+
+TEST(NBBS, compact)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        uint64_t regions = nbbs_total_memory / nbbs_max_size;
+        std::vector<void*> allocs = {};
+        std::vector<void*> whole = {};
+
+        for (uint64_t i = 0; i < regions; i++) {
+                whole.push_back(nb_alloc(nbbs_max_size));
+        }
+
+        /*
+         * Every region is split; region #4 has the fewest pages, but its
+         * only one isn't movable. Region #5 has the fewest movable ones
+         */
+        std::vector<void*> temps = {};
+        for (uint64_t i = 0; i < regions; i++) {
+                nb_free(whole[i]);
+
+                uint32_t count = i == 4 ? 1 : (i == 5 ? 2 : 3);
+                for (uint32_t j = 0; j < nbbs_max_size / nbbs_min_size; j++) {
+                        void *alloc = i == 4 && j == 0 ?
+                                nb_alloc(nbbs_min_size) :
+                                nb_alloc_flags(nbbs_min_size,
+                                        NB_ALLOC_MOVABLE);
+                        ASSERT_EQ((uint64_t) whole[i] + j * nbbs_min_size,
+                                (uint64_t) alloc);
+
+                        if (j < count) {
+                                memset(alloc, (int) allocs.size(),
+                                        nbbs_min_size);
+                                allocs.push_back(alloc);
+                        } else {
+                                temps.push_back(alloc);
+                        }
+                }
+        }
+
+        for (auto temp : temps) {
+                nb_free(temp);
+        }
+
+        EXPECT_EQ(0ULL, nb_stat_free_blocks(nbbs_max_order));
+        EXPECT_EQ((void*) 0, nb_alloc(nbbs_max_size));
+
+        uint64_t used = nb_stat_used_memory();
+        nbbs_compact_ctx ctx = {&allocs, 0, ~0U};
+
+        /* Refused moves leave everything in place */
+        EXPECT_EQ(NB_COMPACT_FAIL, nb_compact(nbbs_max_order, nbbs_relocate,
+                &ctx, NB_WAIT_FOREVER));
+        EXPECT_EQ(used, nb_stat_used_memory());
+        EXPECT_EQ(0ULL, nb_stat_free_blocks(nbbs_max_order));
+        EXPECT_EQ(0U, ctx.moved);
+
+        /* A refused block is skipped; the next one is still moved */
+        ctx.refuse = 1;
+        EXPECT_EQ(NB_COMPACT_FAIL, nb_compact(nbbs_max_order, nbbs_relocate,
+                &ctx, NB_WAIT_FOREVER));
+        EXPECT_EQ(0U, ctx.refuse);
+        EXPECT_EQ(1U, ctx.moved);
+        EXPECT_EQ(used, nb_stat_used_memory());
+        EXPECT_EQ(0ULL, nb_stat_free_blocks(nbbs_max_order));
+
+        /* No time left; one block per call */
+        EXPECT_EQ(NB_COMPACT_PARTIAL, nb_compact(nbbs_max_order,
+                nbbs_relocate, &ctx, 0));
+        EXPECT_EQ(2U, ctx.moved);
+        EXPECT_EQ(used, nb_stat_used_memory());
+
+        EXPECT_EQ(NB_COMPACT_DONE, nb_compact(nbbs_max_order, nbbs_relocate,
+                &ctx, NB_WAIT_FOREVER));
+        EXPECT_EQ(2U, ctx.moved);
+        EXPECT_EQ(1ULL, nb_stat_free_blocks(nbbs_max_order));
+
+        /* Region #5 is free again & the contents moved along */
+        void *block = nb_alloc(nbbs_max_size);
+        EXPECT_EQ((uint64_t) whole[5], (uint64_t) block);
+
+        /* The unmovable page stayed where it was */
+        EXPECT_NE(allocs.end(),
+                std::find(allocs.begin(), allocs.end(), whole[4]));
+
+        for (uint64_t i = 0; i < allocs.size(); i++) {
+                uint8_t *alloc = static_cast<uint8_t*>(allocs[i]);
+                EXPECT_EQ((uint8_t) i, alloc[0]);
+                EXPECT_EQ((uint8_t) i, alloc[nbbs_min_size - 1]);
+        }
+
+        nb_free(block);
+        for (auto alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(regions, nb_stat_free_blocks(nbbs_max_order));
+
+        std::free(playground);
+}
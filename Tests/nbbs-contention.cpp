@@ -0,0 +1,88 @@
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, contention)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        EXPECT_EQ(0ULL, nb_stat_cas_failures(NB_SITES));
+
+        uint64_t occupy = nb_stat_cas_failures(NB_SITE_OCCUPY);
+
+        /* A busy node can't be taken */
+        void *block = nb_alloc(nbbs_max_size);
+        nb_node_t node = EXP2(nbbs_base_level);
+        ASSERT_EQ(node, __nb_try_alloc(node));
+        EXPECT_EQ(occupy + 1, nb_stat_cas_failures(NB_SITE_OCCUPY));
+
+        /* Counts of exited threads are kept */
+        std::thread other([node]() {
+                EXPECT_EQ(node, __nb_try_alloc(node));
+        });
+        other.join();
+        EXPECT_EQ(occupy + 2, nb_stat_cas_failures(NB_SITE_OCCUPY));
+
+        nb_free(block);
+
+        /* Window doubles per failure up to the max, halves per attempt */
+        std::thread([]() {
+                EXPECT_EQ(0U, __nb_backoff());
+                uint64_t mark = nb_stat_cas_failures(NB_SITE_MARK);
+
+                uint32_t window = NB_BACKOFF_MIN;
+                for (; window <= NB_BACKOFF_MAX; window <<= 1) {
+                        __nb_contended(NB_SITE_MARK);
+                        EXPECT_EQ(window, __nb_backoff());
+                }
+
+                /* Yields instead of growing */
+                __nb_contended(NB_SITE_MARK);
+                EXPECT_EQ(NB_BACKOFF_MAX, __nb_backoff());
+
+                __nb_uncontended();
+                EXPECT_EQ(NB_BACKOFF_MAX / 2, __nb_backoff());
+                __nb_uncontended();
+                EXPECT_EQ(NB_BACKOFF_MAX / 4, __nb_backoff());
+
+                uint64_t calls = __builtin_ctz(NB_BACKOFF_MAX / NB_BACKOFF_MIN)
+                        + 2;
+                EXPECT_EQ(mark + calls, nb_stat_cas_failures(NB_SITE_MARK));
+        }).join();
+
+        /* Threads come & go while all of them fight over one base block */
+
+        for (int round = 0; round < 4; round++) {
+                std::vector<std::thread> threads = {};
+
+                for (int i = 0; i < nbbs_thread_count; i++) {
+                        threads.push_back(std::thread([]() {
+                                for (int j = 0; j < nbbs_iter_count; j++) {
+                                        void *alloc = nb_alloc(nbbs_min_size);
+                                        ASSERT_NE((void*) 0, alloc);
+                                        nb_free(alloc);
+                                }
+                        }));
+                }
+
+                for (std::thread &thread : threads) {
+                        thread.join();
+                }
+        }
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size,
+                nb_stat_free_blocks(nbbs_max_order));
+
+        std::free(playground);
+}
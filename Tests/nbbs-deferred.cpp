@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <thread>
+#include <random>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+/* Random 'order' generator */
+thread_local std::mt19937 mt_deferred(std::random_device{}());
+thread_local std::uniform_int_distribution<> dist_deferred(0, nbbs_max_order);
+
+static void thread_defer(int id)
+{
+        for (auto i = 0; i < nbbs_iter_count; i++) {
+                uint64_t size = nb_stat_block_size(dist_deferred(mt_deferred));
+
+                int *alloc = (int*) nb_alloc(size);
+                if (!alloc) {
+                        continue;
+                }
+
+                std::fill_n(alloc, size / sizeof(int), id);
+                for (uint64_t j = 0; j < size / sizeof(int); j++) {
+                        ASSERT_EQ(alloc[j], id);
+                }
+
+                nb_free_deferred(alloc);
+        }
+}
+
+TEST(NBBS, deferred)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Held until reclaimed */
+        std::vector<void*> allocs = {};
+        for (uint32_t i = 0; i <= nbbs_max_order; i++) {
+                void *alloc = nb_alloc(nb_stat_block_size(i));
+                ASSERT_NE((void*) 0, alloc);
+                allocs.push_back(alloc);
+        }
+
+        uint64_t used = nb_stat_used_memory();
+        for (auto alloc : allocs) {
+                nb_free_deferred(alloc);
+        }
+        nb_free_deferred(0);
+
+        EXPECT_EQ(used, nb_stat_used_memory());
+        EXPECT_EQ(used, nb_stat_deferred_memory());
+
+        EXPECT_EQ(nbbs_max_order + 1, nb_reclaim());
+        EXPECT_EQ(0ULL, nb_reclaim());
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(0ULL, nb_stat_deferred_memory());
+
+        /* An allocation that finds no room drains the queue */
+        allocs.clear();
+        for (;;) {
+                void *alloc = nb_alloc(nbbs_max_size);
+                if (!alloc) {
+                        break;
+                }
+                allocs.push_back(alloc);
+        }
+        ASSERT_EQ(nbbs_total_memory / nbbs_max_size, allocs.size());
+
+        for (auto alloc : allocs) {
+                nb_free_deferred(alloc);
+        }
+        EXPECT_EQ(nbbs_total_memory, nb_stat_deferred_memory());
+
+        void *alloc = nb_alloc(nbbs_max_size);
+        EXPECT_NE((void*) 0, alloc);
+        EXPECT_EQ(0ULL, nb_stat_deferred_memory());
+        nb_free(alloc);
+
+        /* Many producers & a reclaimer */
+        std::atomic<bool> done = false;
+        std::thread reclaimer([&done]() {
+                while (!done) {
+                        nb_reclaim();
+                        std::this_thread::yield();
+                }
+        });
+
+        std::vector<std::thread> threads = {};
+        for (int i = 0; i < nbbs_thread_count; i++) {
+                threads.push_back(std::thread(thread_defer, i + 1));
+        }
+
+        for (auto& thread : threads) {
+                thread.join();
+        }
+
+        done = true;
+        reclaimer.join();
+        nb_reclaim();
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(0ULL, nb_stat_deferred_memory());
+
+        /* Reserved pages are ignored, like nb_free does */
+        uint64_t *hole = (uint64_t*) (playground + nbbs_total_memory -
+                nbbs_min_size);
+        ASSERT_EQ(0, nb_reserve_range((uint64_t) hole, nbbs_min_size));
+
+        *hole = 0x5A5A5A5AULL;
+        nb_free_deferred(hole);
+        EXPECT_EQ(0ULL, nb_stat_deferred_memory());
+        EXPECT_EQ(0x5A5A5A5AULL, *hole);
+        EXPECT_EQ(0ULL, nb_reclaim());
+
+        std::free(playground);
+}
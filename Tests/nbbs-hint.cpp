@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+#if NB_SCAN_HINT
+TEST(NBBS, hint)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Fill up; every page is the leftmost one */
+        uint64_t pages = nbbs_total_memory / nbbs_min_size;
+        for (uint64_t i = 0; i < pages; i++) {
+                void *page = nb_alloc(nbbs_min_size);
+                ASSERT_EQ((uint64_t) playground + i * nbbs_min_size,
+                        (uint64_t) page);
+        }
+        EXPECT_EQ((void*) 0, nb_alloc(nbbs_min_size));
+
+        /* Released pages left of the hint are found again, leftmost first */
+        nb_free(playground + 100 * nbbs_min_size);
+        nb_free(playground + 7 * nbbs_min_size);
+
+        EXPECT_EQ(playground + 7 * nbbs_min_size, nb_alloc(nbbs_min_size));
+        EXPECT_EQ(playground + 100 * nbbs_min_size, nb_alloc(nbbs_min_size));
+        EXPECT_EQ((void*) 0, nb_alloc(nbbs_min_size));
+
+        /* Coalesced buddies lower the hint of the order above */
+        EXPECT_EQ((void*) 0, nb_alloc(2 * nbbs_min_size));
+        nb_free(playground + 10 * nbbs_min_size);
+        nb_free(playground + 11 * nbbs_min_size);
+
+        EXPECT_EQ(playground + 10 * nbbs_min_size,
+                nb_alloc(2 * nbbs_min_size));
+
+        /* A released max order block, for every order below */
+        uint64_t per_max = nbbs_max_size / nbbs_min_size;
+        for (uint64_t i = per_max; i < 2 * per_max; i++) {
+                nb_free(playground + i * nbbs_min_size);
+        }
+
+        EXPECT_EQ(playground + nbbs_max_size, nb_alloc(nbbs_max_size / 2));
+        EXPECT_EQ(playground + nbbs_max_size + nbbs_max_size / 2,
+                nb_alloc(nbbs_max_size / 4));
+
+        nb_free(playground + nbbs_max_size);
+        nb_free(playground + nbbs_max_size + nbbs_max_size / 2);
+        nb_free(playground + 10 * nbbs_min_size);
+        for (uint64_t i = 0; i < pages; i++) {
+                if ((i < per_max && i != 10 && i != 11) || 2 * per_max <= i) {
+                        nb_free(playground + i * nbbs_min_size);
+                }
+        }
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(playground, nb_alloc(nbbs_max_size));
+        nb_free(playground);
+
+        std::free(playground);
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+#if NB_INSTRUMENT
+
+struct histograms {
+        uint64_t buckets[NB_HISTS][NB_HIST_BUCKETS];
+
+        histograms()
+        {
+                for (uint32_t hist = 0; hist < NB_HISTS; hist++) {
+                        EXPECT_EQ(0, nb_stat_histogram(hist, buckets[hist]));
+                }
+        }
+
+        /* Bucket that got the one value recorded since */
+        int64_t single(const histograms &before, uint32_t hist) const
+        {
+                int64_t bucket = -1;
+
+                for (uint32_t i = 0; i < NB_HIST_BUCKETS; i++) {
+                        uint64_t delta = buckets[hist][i] -
+                                before.buckets[hist][i];
+                        if (delta == 1 && bucket < 0) {
+                                bucket = i;
+                        } else if (delta) {
+                                return -2;
+                        }
+                }
+
+                return bucket;
+        }
+};
+
+TEST(NBBS, histogram)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        nb_set_combining(NB_COMBINE_OFF);
+
+        uint64_t buckets[NB_HIST_BUCKETS];
+        EXPECT_EQ(1, nb_stat_histogram(NB_HISTS, buckets));
+        EXPECT_EQ(1, nb_stat_histogram(NB_HIST_SCANNED, 0));
+
+        /* First leaf; climbs up to the base level */
+        histograms before;
+        void *page = nb_alloc(nbbs_min_size);
+        histograms after;
+
+        EXPECT_LE(0, after.single(before, NB_HIST_ALLOC_TICKS));
+        EXPECT_EQ(1, after.single(before, NB_HIST_SCANNED));
+        EXPECT_EQ(0, after.single(before, NB_HIST_FAILURES));
+        EXPECT_EQ(0, after.single(before, NB_HIST_RESTARTS));
+        EXPECT_EQ(LOG2_LOWER(nbbs_max_order) + 1,
+                (uint64_t) after.single(before, NB_HIST_CLIMBED));
+        EXPECT_EQ(-1, after.single(before, NB_HIST_FREE_TICKS));
+
+        nb_free(page);
+        histograms freed;
+        EXPECT_LE(0, freed.single(after, NB_HIST_FREE_TICKS));
+        EXPECT_EQ(-1, freed.single(after, NB_HIST_SCANNED));
+        EXPECT_LT(0, freed.single(after, NB_HIST_CLIMBED));
+
+        /* Leaves under a max order block look free; one failed try */
+        void *max = nb_alloc(nbbs_max_size);
+        uint64_t occupy = nb_stat_cas_failures(NB_SITE_OCCUPY);
+        uint64_t mark = nb_stat_cas_failures(NB_SITE_MARK);
+
+        before = histograms();
+        page = nb_alloc(nbbs_min_size);
+        after = histograms();
+
+        EXPECT_EQ((uint64_t) playground + nbbs_max_size, (uint64_t) page);
+        EXPECT_EQ(2, after.single(before, NB_HIST_SCANNED));
+        EXPECT_EQ(1, after.single(before, NB_HIST_FAILURES));
+
+        /* Skipped on its ancestors; only the page taken climbs */
+        EXPECT_EQ(LOG2_LOWER(nbbs_max_order) + 1,
+                (uint64_t) after.single(before, NB_HIST_CLIMBED));
+        EXPECT_EQ(occupy, nb_stat_cas_failures(NB_SITE_OCCUPY));
+        EXPECT_EQ(mark, nb_stat_cas_failures(NB_SITE_MARK));
+
+        nb_free(page);
+
+        /* Colored scans skip them the same way */
+        before = histograms();
+        page = nb_alloc_colored(nbbs_min_size, 3);
+        after = histograms();
+
+        EXPECT_EQ((uint64_t) playground + nbbs_max_size + 3 * nbbs_min_size,
+                (uint64_t) page);
+        EXPECT_EQ(2, after.single(before, NB_HIST_SCANNED));
+        EXPECT_EQ(1, after.single(before, NB_HIST_FAILURES));
+        EXPECT_EQ(LOG2_LOWER(nbbs_max_order) + 1,
+                (uint64_t) after.single(before, NB_HIST_CLIMBED));
+        EXPECT_EQ(occupy, nb_stat_cas_failures(NB_SITE_OCCUPY));
+
+        nb_free(page);
+        nb_free(max);
+
+#if NB_SCAN_HINT
+        /* Scans start at the hint, past the taken pages */
+        std::vector<void*> pages = {};
+        for (uint32_t i = 0; i < 64; i++) {
+                pages.push_back(nb_alloc(nbbs_min_size));
+        }
+
+        before = histograms();
+        page = nb_alloc(nbbs_min_size);
+        after = histograms();
+
+        EXPECT_EQ((uint64_t) playground + 64 * nbbs_min_size, (uint64_t) page);
+        EXPECT_EQ(1, after.single(before, NB_HIST_SCANNED));
+
+        nb_free(page);
+        for (void *alloc : pages) {
+                nb_free(alloc);
+        }
+#endif
+
+        /* Full; a deferred release makes the allocation rescan */
+        std::vector<void*> allocs = {};
+        for (uint64_t i = 0; i < nbbs_total_memory / nbbs_max_size; i++) {
+                allocs.push_back(nb_alloc(nbbs_max_size));
+                ASSERT_NE((void*) 0, allocs.back());
+        }
+
+        nb_free_deferred(allocs.back());
+        before = histograms();
+        allocs.back() = nb_alloc(nbbs_max_size);
+        after = histograms();
+
+        EXPECT_NE((void*) 0, allocs.back());
+        EXPECT_EQ(1, after.single(before, NB_HIST_RESTARTS));
+
+        for (void *alloc : allocs) {
+                nb_free(alloc);
+        }
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        std::free(playground);
+}
+
+#endif
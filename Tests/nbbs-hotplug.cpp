@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, hotplug)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+        uint64_t base = (uint64_t) playground;
+        uint64_t half = nbbs_total_memory / 2;
+
+        EXPECT_EQ(0, nb_init(base, nbbs_total_memory));
+
+        /* Base level blocks only */
+        EXPECT_EQ(1, nb_offline_region(base + nbbs_min_size, nbbs_max_size,
+                0));
+        EXPECT_EQ(1, nb_add_region(base, nbbs_min_size));
+        EXPECT_EQ(1, nb_add_region(base + nbbs_total_memory, nbbs_max_size));
+
+        /* Idle upper half goes away at once */
+        EXPECT_EQ(0, nb_offline_region(base + half, half, 0));
+        EXPECT_EQ(half, nb_stat_total_memory());
+
+        EXPECT_EQ(0, nb_add_region(base + half, half / 2));
+        EXPECT_EQ(half + half / 2, nb_stat_total_memory());
+
+        /* Fenced while a block is in use */
+        void *pinned = nb_alloc(nbbs_min_size);
+        ASSERT_EQ(base, (uint64_t) pinned);
+
+        EXPECT_EQ(1, nb_offline_region(base, nbbs_max_size, 0));
+        EXPECT_EQ(half + half / 2 - nbbs_max_size + nbbs_min_size,
+                nb_stat_total_memory());
+
+        void *next = nb_alloc(nbbs_min_size);
+        EXPECT_LE(base + nbbs_max_size, (uint64_t) next);
+        nb_free(next);
+
+        /* Drains once the owner lets go */
+        std::thread owner([pinned]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                nb_free(pinned);
+        });
+        EXPECT_EQ(0, nb_offline_region(base, nbbs_max_size, NB_WAIT_FOREVER));
+        owner.join();
+        EXPECT_EQ(half + half / 2 - nbbs_max_size, nb_stat_total_memory());
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+
+        /* Everything back */
+        EXPECT_EQ(0, nb_add_region(base, nbbs_total_memory));
+        EXPECT_EQ(nbbs_total_memory, nb_stat_total_memory());
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size,
+                nb_stat_free_blocks(nbbs_max_order));
+
+        /* Concurrent allocations while a region comes & goes */
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> threads = {};
+
+        for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&stop]() {
+                        while (!stop) {
+                                void *alloc = nb_alloc(nbbs_min_size);
+                                if (alloc) {
+                                        nb_free(alloc);
+                                }
+                        }
+                });
+        }
+
+        for (int i = 0; i < 100; i++) {
+                EXPECT_EQ(0, nb_offline_region(base, half, NB_WAIT_FOREVER));
+                EXPECT_EQ(0, nb_add_region(base, half));
+        }
+
+        stop = true;
+        for (auto &thread : threads) {
+                thread.join();
+        }
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(nbbs_total_memory, nb_stat_total_memory());
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size,
+                nb_stat_free_blocks(nbbs_max_order));
+
+        /* Reserved ranges are not plugged in */
+        ASSERT_EQ(0, nb_reserve_range(base, nbbs_min_size));
+        EXPECT_EQ(0, nb_offline_region(base, nbbs_max_size, 0));
+        EXPECT_EQ(0, nb_add_region(base, nbbs_total_memory));
+        EXPECT_EQ(nbbs_total_memory - nbbs_min_size, nb_stat_total_memory());
+
+        void *page = nb_alloc(nbbs_min_size);
+        EXPECT_EQ(base + nbbs_min_size, (uint64_t) page);
+        nb_free(page);
+
+        std::free(playground);
+}
@@ -0,0 +1,67 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, hugepage)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Max order block is exactly one huge page */
+        uint64_t regions = nbbs_total_memory / NB_HUGE_SIZE;
+        EXPECT_EQ(regions, nb_stat_huge_free());
+
+        /* Region #0 whole, region #1 split */
+        void *whole = nb_alloc(nbbs_max_size);
+        void *small = nb_alloc(nbbs_min_size);
+        ASSERT_EQ((uint64_t) playground, (uint64_t) whole);
+        ASSERT_EQ((uint64_t) playground + nbbs_max_size, (uint64_t) small);
+        EXPECT_EQ(regions - 2, nb_stat_huge_free());
+
+        nb_free(whole);
+        EXPECT_EQ(regions - 1, nb_stat_huge_free());
+
+        /* First fit splits region #0 again */
+        void *ff = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground, (uint64_t) ff);
+        EXPECT_EQ(regions - 2, nb_stat_huge_free());
+        nb_free(ff);
+
+        /* Huge pack keeps it whole */
+        nb_set_policy(NB_POLICY_HUGE_PACK);
+
+        std::vector<void*> allocs = {};
+        for (uint32_t i = 1; i < nbbs_max_size / nbbs_min_size; i++) {
+                void *alloc = nb_alloc(nbbs_min_size);
+                ASSERT_NE((void*) 0, alloc);
+                EXPECT_LE((uint64_t) playground + nbbs_max_size,
+                        (uint64_t) alloc);
+                EXPECT_GT((uint64_t) playground + 2 * nbbs_max_size,
+                        (uint64_t) alloc);
+                allocs.push_back(alloc);
+        }
+        EXPECT_EQ(regions - 1, nb_stat_huge_free());
+
+        /* Region #1 is full; the next one breaks the leftmost whole region */
+        void *next = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground, (uint64_t) next);
+        EXPECT_EQ(regions - 2, nb_stat_huge_free());
+
+        nb_free(next);
+        nb_free(small);
+        for (auto alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(regions, nb_stat_huge_free());
+
+        std::free(playground);
+}
@@ -21,6 +21,12 @@ TEST(NBBS, init)
         /* Less than min/alloc/page size is NOT allowed */
         EXPECT_EQ(1, nb_init((uint64_t) playground, nbbs_min_size - 1));
 
+#ifndef NB_NODE_64
+        /* Node ids of 2^30 leaves don't fit into 32 bits with index flags */
+        EXPECT_EQ(1, nb_init((uint64_t) playground,
+                (1ULL << 30) * nbbs_min_size));
+#endif
+
         /* Min/alloc/page size allowed */
         EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_min_size));
 
@@ -0,0 +1,92 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+static constexpr uint64_t nbbs_mib = 1024 * 1024;
+
+TEST(NBBS, map)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+        uint64_t base = (uint64_t) playground;
+
+        /* Unsorted or overlapping */
+        struct nb_region bad[] = {
+                {base + 8 * nbbs_mib, nbbs_mib},
+                {base, 10 * nbbs_mib},
+        };
+        EXPECT_EQ(1, nb_init_map(bad, 2));
+        EXPECT_EQ(1, nb_init_map(bad, 0));
+
+        /* Second region starts in the middle of a page */
+        struct nb_region regions[] = {
+                {base, 10 * nbbs_mib},
+                {base + 12 * nbbs_mib + 100, 8 * nbbs_mib},
+                {base + 40 * nbbs_mib, 5 * nbbs_mib},
+        };
+        ASSERT_EQ(0, nb_init_map(regions, 3));
+
+        uint64_t total = 23 * nbbs_mib - nbbs_min_size;
+        EXPECT_EQ(total, nb_stat_total_memory());
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+
+        /* Freeing a hole is ignored */
+        nb_free((void*) (base + 10 * nbbs_mib));
+        EXPECT_EQ(total, nb_stat_total_memory());
+
+        /* Reserve the two pages it touches */
+        EXPECT_EQ(0, nb_reserve_range(base + nbbs_mib + 1, nbbs_min_size));
+        total -= 2 * nbbs_min_size;
+        EXPECT_EQ(total, nb_stat_total_memory());
+
+        EXPECT_EQ(1, nb_reserve_range(base + nbbs_total_memory, 1));
+        EXPECT_EQ(1, nb_reserve_range(base - nbbs_min_size, 1));
+
+        /* Only pages within the regions are handed out */
+        std::vector<void*> allocs = {};
+        for (;;) {
+                void *alloc = nb_alloc(nbbs_min_size);
+                if (!alloc) {
+                        break;
+                }
+
+                uint64_t addr = (uint64_t) alloc;
+                bool inside = false;
+                for (auto &region : regions) {
+                        inside = inside || (region.base <= addr &&
+                                addr + nbbs_min_size <=
+                                region.base + region.size);
+                }
+                EXPECT_TRUE(inside);
+                EXPECT_NE(base + nbbs_mib, addr);
+                EXPECT_NE(base + nbbs_mib + nbbs_min_size, addr);
+
+                allocs.push_back(alloc);
+        }
+        EXPECT_EQ(total, allocs.size() * nbbs_min_size);
+        EXPECT_EQ(total, nb_stat_used_memory());
+
+        /* Already in use */
+        EXPECT_EQ(1, nb_reserve_range((uint64_t) allocs[0],
+                2 * nbbs_max_size));
+        EXPECT_EQ(total, nb_stat_total_memory());
+
+        for (auto alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+
+        /* Block #0 holds the reserved pages */
+        void *block = nb_alloc(nbbs_max_size);
+        EXPECT_EQ(base + nbbs_max_size, (uint64_t) block);
+        nb_free(block);
+
+        std::free(playground);
+}
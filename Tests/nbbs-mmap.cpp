@@ -0,0 +1,102 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+/* Number of resident pages in [addr, addr + size) */
+static uint64_t resident_pages(void *addr, uint64_t size)
+{
+        uint64_t page_size = sysconf(_SC_PAGESIZE);
+        std::vector<unsigned char> vec((size + page_size - 1) / page_size);
+
+        if (mincore(addr, size, vec.data())) {
+                return 0;
+        }
+
+        return std::count_if(vec.begin(), vec.end(),
+                [](unsigned char v) { return v & 1; });
+}
+
+TEST(NBBS, mmap)
+{
+        /* Smaller than a max order block is NOT allowed */
+        EXPECT_EQ(1, nb_init_mmap(nbbs_max_size - 1));
+
+        ASSERT_EQ(0, nb_init_mmap(nbbs_total_memory));
+
+        /* Nothing is committed before the first allocation */
+        EXPECT_EQ(0ULL, nb_stat_committed_memory());
+
+        /* Committed on demand, one max order block at a time */
+        uint8_t *block = (uint8_t*) nb_alloc(nbbs_min_size);
+        ASSERT_NE((void*) 0, block);
+        EXPECT_EQ(nbbs_max_size, nb_stat_committed_memory());
+
+        std::fill_n(block, nbbs_min_size, 0xAB);
+        EXPECT_EQ(0xAB, block[nbbs_min_size - 1]);
+
+        /* Release on every free of a max order block */
+        nb_set_release(nbbs_max_order, 0);
+
+        uint8_t *large = (uint8_t*) nb_alloc(nbbs_max_size);
+        ASSERT_NE((void*) 0, large);
+        std::fill_n(large, nbbs_max_size, 0xCD);
+        EXPECT_LT(0ULL, resident_pages(large, nbbs_max_size));
+
+        nb_free(large);
+        EXPECT_EQ(nbbs_max_size, nb_stat_released_memory());
+        EXPECT_EQ(0ULL, resident_pages(large, nbbs_max_size));
+
+        /* Taken back until it's handed out again */
+        EXPECT_EQ(nbbs_max_size, nb_stat_committed_memory());
+
+        /* Released blocks stay usable */
+        large = (uint8_t*) nb_alloc(nbbs_max_size);
+        ASSERT_NE((void*) 0, large);
+        EXPECT_EQ(0, large[0]);
+        std::fill_n(large, nbbs_max_size, 0xCD);
+        nb_free(large);
+        EXPECT_EQ(2 * nbbs_max_size, nb_stat_released_memory());
+
+        /* Smaller frees release only once their buddies coalesce */
+        nb_free(block);
+        EXPECT_EQ(3 * nbbs_max_size, nb_stat_released_memory());
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(0ULL, nb_stat_committed_memory());
+
+        /* Rate limited */
+        nb_set_release(nbbs_max_order, UINT64_MAX);
+
+        large = (uint8_t*) nb_alloc(nbbs_max_size);
+        ASSERT_NE((void*) 0, large);
+        nb_free(large);
+        EXPECT_EQ(3 * nbbs_max_size, nb_stat_released_memory());
+        EXPECT_EQ(nbbs_max_size, nb_stat_committed_memory());
+
+        /* Held back, not dropped */
+        nb_set_release(nbbs_max_order, 0);
+        nb_reclaim();
+        EXPECT_EQ(4 * nbbs_max_size, nb_stat_released_memory());
+        EXPECT_EQ(0ULL, nb_stat_committed_memory());
+
+        /* Reclaimed by the next release as well */
+        nb_set_release(nbbs_max_order, UINT64_MAX);
+        large = (uint8_t*) nb_alloc(nbbs_max_size);
+        uint8_t *other = (uint8_t*) nb_alloc(nbbs_max_size);
+        ASSERT_NE((void*) 0, other);
+        nb_free(large);
+        EXPECT_EQ(4 * nbbs_max_size, nb_stat_released_memory());
+
+        nb_set_release(nbbs_max_order, 0);
+        nb_free(other);
+        EXPECT_EQ(6 * nbbs_max_size, nb_stat_released_memory());
+        EXPECT_EQ(0ULL, nb_stat_committed_memory());
+}
@@ -0,0 +1,76 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, mobility)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        uint64_t regions = nbbs_total_memory / nbbs_max_size;
+        uint64_t pages = nbbs_max_size / nbbs_min_size;
+
+        /* Each type claims a region of its own */
+        void *pinned = nb_alloc_flags(nbbs_min_size, NB_ALLOC_UNMOVABLE);
+        void *movable = nb_alloc_flags(nbbs_min_size, NB_ALLOC_MOVABLE);
+        void *cache = nb_alloc_flags(nbbs_min_size, NB_ALLOC_RECLAIMABLE);
+        void *pinned2 = nb_alloc_flags(nbbs_min_size, NB_ALLOC_UNMOVABLE);
+        EXPECT_EQ((uint64_t) playground, (uint64_t) pinned);
+        EXPECT_EQ((uint64_t) playground + nbbs_max_size, (uint64_t) movable);
+        EXPECT_EQ((uint64_t) playground + 2 * nbbs_max_size, (uint64_t) cache);
+        EXPECT_EQ((uint64_t) playground + nbbs_min_size, (uint64_t) pinned2);
+
+        EXPECT_EQ(1ULL, nb_stat_mobility_regions(NB_ALLOC_UNMOVABLE));
+        EXPECT_EQ(1ULL, nb_stat_mobility_regions(NB_ALLOC_MOVABLE));
+        EXPECT_EQ(1ULL, nb_stat_mobility_regions(NB_ALLOC_RECLAIMABLE));
+
+        /* Untyped allocations are not grouped */
+        void *plain = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground + 2 * nbbs_min_size, (uint64_t) plain);
+
+        /* Use up the whole regions */
+        std::vector<void*> allocs = {};
+        for (uint64_t i = 3; i < regions; i++) {
+                void *alloc = nb_alloc(nbbs_max_size);
+                ASSERT_NE((void*) 0, alloc);
+                allocs.push_back(alloc);
+        }
+
+        /* Fill the movable region */
+        for (uint64_t i = 1; i < pages; i++) {
+                void *alloc = nb_alloc_flags(nbbs_min_size, NB_ALLOC_MOVABLE);
+                EXPECT_LE((uint64_t) playground + nbbs_max_size,
+                        (uint64_t) alloc);
+                EXPECT_GT((uint64_t) playground + 2 * nbbs_max_size,
+                        (uint64_t) alloc);
+                allocs.push_back(alloc);
+        }
+
+        /* Under pressure; steal from the leftmost region with room */
+        void *stolen = nb_alloc_flags(nbbs_min_size, NB_ALLOC_MOVABLE);
+        EXPECT_EQ((uint64_t) playground + 3 * nbbs_min_size, (uint64_t) stolen);
+        EXPECT_EQ(1ULL, nb_stat_mobility_regions(NB_ALLOC_MOVABLE));
+
+        nb_free(stolen);
+        nb_free(plain);
+        nb_free(pinned);
+        nb_free(pinned2);
+        nb_free(movable);
+        nb_free(cache);
+        for (auto alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(0ULL, nb_stat_mobility_regions(NB_ALLOC_MOVABLE));
+
+        std::free(playground);
+}
@@ -0,0 +1,86 @@
+#include "gtest/gtest.h"
+
+#include <barrier>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+TEST(NBBS, partition)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        nb_set_policy(NB_POLICY_PARTITION);
+
+        /* Alone; the whole arena is ours */
+        void *block = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground, (uint64_t) block);
+        nb_free(block);
+
+        constexpr int threads_count = 4;
+        uint64_t regions = nbbs_total_memory / nbbs_max_size;
+
+        std::barrier sync(threads_count);
+        std::vector<uint64_t> region(threads_count);
+        std::vector<std::thread> threads = {};
+
+        for (int i = 0; i < threads_count; i++) {
+                threads.push_back(std::thread([&, i]() {
+                        /* Register; shares change until all of us did */
+                        nb_free(nb_alloc(nbbs_min_size));
+                        sync.arrive_and_wait();
+
+                        void *alloc = nb_alloc(nbbs_min_size);
+                        ASSERT_NE((void*) 0, alloc);
+                        region[i] = ((uint64_t) alloc - (uint64_t) playground)
+                                / nbbs_max_size;
+                        sync.arrive_and_wait();
+
+                        nb_free(alloc);
+                        sync.arrive_and_wait();
+
+                        /* Own share runs dry; steal the rest */
+                        if (!i) {
+                                std::vector<void*> allocs = {};
+                                for (uint64_t j = 0; j < regions; j++) {
+                                        allocs.push_back(
+                                                nb_alloc(nbbs_max_size));
+                                        EXPECT_NE((void*) 0, allocs.back());
+                                }
+                                EXPECT_EQ((void*) 0, nb_alloc(nbbs_min_size));
+
+                                for (void *alloc : allocs) {
+                                        nb_free(alloc);
+                                }
+                        }
+                        sync.arrive_and_wait();
+                }));
+        }
+
+        for (std::thread &thread : threads) {
+                thread.join();
+        }
+
+        /* Each thread allocated from its own share */
+        std::set<uint64_t> distinct(region.begin(), region.end());
+        EXPECT_EQ((size_t) threads_count, distinct.size());
+
+        /* Alone again; shares are rebalanced */
+        block = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) playground, (uint64_t) block);
+        nb_free(block);
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        EXPECT_EQ(regions, nb_stat_free_blocks(nbbs_max_order));
+
+        nb_set_policy(NB_POLICY_FIRST_FIT);
+        std::free(playground);
+}
@@ -0,0 +1,115 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <random>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+/* Alloc & free until killed */
+static void churn()
+{
+        std::mt19937 mt(getpid());
+        std::uniform_int_distribution<> dist(0, nbbs_max_order);
+        std::vector<uint64_t> offsets = {};
+
+        for (;;) {
+                uint64_t offset = nb_alloc_offset(
+                        nb_stat_block_size(dist(mt)));
+                if (offset != NB_INVALID_OFFSET) {
+                        offsets.push_back(offset);
+                }
+
+                if (offsets.size() && (offset == NB_INVALID_OFFSET ||
+                                dist(mt) % 2)) {
+                        nb_free_offset(offsets.back());
+                        offsets.pop_back();
+                }
+        }
+}
+
+TEST(NBBS, persistent)
+{
+        std::string path = "/tmp/nbbs-test-" + std::to_string(getpid());
+        unlink(path.c_str());
+
+        /* Create */
+        ASSERT_EQ(0, nb_open_file(path.c_str(), nbbs_total_memory));
+        EXPECT_EQ(nbbs_total_memory, nb_stat_total_memory());
+
+        std::vector<uint64_t> offsets = {};
+        for (uint32_t i = 0; i <= nbbs_max_order; i++) {
+                uint64_t offset = nb_alloc_offset(nb_stat_block_size(i));
+                ASSERT_NE(NB_INVALID_OFFSET, offset);
+
+                std::fill_n((uint8_t*) nb_offset_to_addr(offset),
+                        nb_stat_block_size(i), i + 1);
+                offsets.push_back(offset);
+        }
+
+        uint64_t used = nb_stat_used_memory();
+        ASSERT_EQ(0, nb_close_file());
+        EXPECT_EQ(1, nb_close_file());
+
+        /* Reopen; blocks & contents survive */
+        ASSERT_EQ(0, nb_open_file(path.c_str(), 0));
+        EXPECT_EQ(used, nb_stat_used_memory());
+
+        for (uint32_t i = 0; i <= nbbs_max_order; i++) {
+                uint8_t *block = (uint8_t*) nb_offset_to_addr(offsets[i]);
+                EXPECT_EQ(i + 1, block[0]);
+                EXPECT_EQ(i + 1, block[nb_stat_block_size(i) - 1]);
+        }
+
+        for (auto offset : offsets) {
+                nb_free_offset(offset);
+        }
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        ASSERT_EQ(0, nb_close_file());
+
+        /* Crash in the middle of allocs & frees */
+        ASSERT_EQ(0, nb_open_file(path.c_str(), 0));
+
+        pid_t pid = fork();
+        ASSERT_LE(0, pid);
+        if (pid == 0) {
+                churn();
+                _exit(0);
+        }
+
+        usleep(100 * 1000);
+        kill(pid, SIGKILL);
+        waitpid(pid, 0, 0);
+
+        /* Reopen without closing; the tree must be consistent again */
+        ASSERT_EQ(0, nb_open_file(path.c_str(), 0));
+
+        uint64_t free_blocks = (nbbs_total_memory - nb_stat_used_memory()) /
+                nbbs_min_size;
+        for (uint64_t i = 0; i < free_blocks; i++) {
+                ASSERT_NE(NB_INVALID_OFFSET, nb_alloc_offset(nbbs_min_size));
+        }
+        EXPECT_EQ(NB_INVALID_OFFSET, nb_alloc_offset(nbbs_min_size));
+        EXPECT_EQ(nbbs_total_memory, nb_stat_used_memory());
+        ASSERT_EQ(0, nb_close_file());
+
+        /* Corrupted header */
+        int fd = open(path.c_str(), O_RDWR);
+        ASSERT_LE(0, fd);
+        uint64_t bogus = 1;
+        ASSERT_EQ((ssize_t) sizeof(bogus),
+                pwrite(fd, &bogus, sizeof(bogus), 16));
+        close(fd);
+
+        EXPECT_EQ(1, nb_open_file(path.c_str(), 0));
+
+        unlink(path.c_str());
+}
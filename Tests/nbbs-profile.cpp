@@ -0,0 +1,109 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+#if NB_PROFILE
+
+static std::vector<std::string> dump()
+{
+        FILE *file = std::tmpfile();
+        EXPECT_NE((FILE*) 0, file);
+        EXPECT_EQ(0, nb_profile_dump(fileno(file)));
+
+        std::vector<std::string> lines = {};
+        std::rewind(file);
+
+        char line[4096];
+        while (std::fgets(line, sizeof(line), file)) {
+                lines.push_back(line);
+        }
+        std::fclose(file);
+
+        return lines;
+}
+
+TEST(NBBS, profile)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        EXPECT_EQ(0ULL, dump().size());
+
+        /* Every block is sampled */
+        nb_profile_set_rate(1);
+
+        void *page = nb_alloc(nbbs_min_size);
+        void *quad = nb_alloc(4 * nbbs_min_size);
+        void *max = nb_alloc_flags(nbbs_max_size, NB_ALLOC_MOVABLE);
+
+        std::vector<std::string> lines = dump();
+        ASSERT_EQ(3ULL, lines.size());
+
+        uint64_t total = 0;
+        for (std::string &line : lines) {
+                /* frame;frame;...;order_N bytes */
+                size_t space = line.rfind(' ');
+                ASSERT_NE(std::string::npos, space);
+                ASSERT_NE(std::string::npos, line.find(";order_"));
+                total += std::stoull(line.substr(space + 1));
+        }
+        EXPECT_EQ(5 * nbbs_min_size + nbbs_max_size, total);
+
+        /* Samples are dropped on free */
+        nb_free(quad);
+        lines = dump();
+        EXPECT_EQ(2ULL, lines.size());
+
+        /* Deferred frees as well */
+        nb_free_deferred(page);
+        nb_reclaim();
+        lines = dump();
+        ASSERT_EQ(1ULL, lines.size());
+        EXPECT_NE(std::string::npos, lines[0].find(";order_9 "));
+
+        nb_free(max);
+        EXPECT_EQ(0ULL, dump().size());
+
+        /* Disabled */
+        nb_profile_set_rate(0);
+        page = nb_alloc(nbbs_min_size);
+        EXPECT_EQ(0ULL, dump().size());
+        nb_free(page);
+
+        /* Default rate; roughly one sample every NB_PROFILE_RATE bytes */
+        nb_profile_set_rate(NB_PROFILE_RATE);
+
+        std::vector<void*> allocs = {};
+        for (uint64_t i = 0; i < nbbs_total_memory / nbbs_min_size / 2; i++) {
+                allocs.push_back(nb_alloc(nbbs_min_size));
+                ASSERT_NE((void*) 0, allocs.back());
+        }
+
+        uint64_t expected = nbbs_total_memory / 2 / NB_PROFILE_RATE;
+        lines = dump();
+        EXPECT_LT(expected / 4, lines.size());
+        EXPECT_GT(expected * 4, lines.size());
+
+        for (void *alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(0ULL, dump().size());
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        std::free(playground);
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <random>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+/* Allocate & verify blocks; keep the ones at odd iterations */
+static int worker(int id, uint64_t *kept)
+{
+        std::mt19937 mt(id);
+        std::uniform_int_distribution<> dist(0, nbbs_max_order);
+
+        *kept = 0;
+
+        for (auto i = 0; i < nbbs_iter_count; i++) {
+                uint64_t size = nb_stat_block_size(dist(mt));
+                uint64_t offset = nb_alloc_offset(size);
+                if (offset == NB_INVALID_OFFSET) {
+                        continue;
+                }
+
+                int *alloc = (int*) nb_offset_to_addr(offset);
+                std::fill_n(alloc, size / sizeof(int), id);
+
+                /* No other process should've touched the block */
+                for (uint64_t j = 0; j < size / sizeof(int); j++) {
+                        if (alloc[j] != id) {
+                                return 1;
+                        }
+                }
+
+                if (i % 2) {
+                        *kept += size;
+                } else {
+                        nb_free_offset(offset);
+                }
+        }
+
+        return 0;
+}
+
+TEST(NBBS, shared)
+{
+        std::string name = "/nbbs-test-" + std::to_string(getpid());
+
+        /* Results of the children */
+        uint64_t *kept = (uint64_t*) mmap(0,
+                nbbs_thread_count * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        ASSERT_NE(MAP_FAILED, (void*) kept);
+
+        ASSERT_EQ(0, nb_init_shared(name.c_str(), nbbs_total_memory));
+
+        /* Name is taken */
+        EXPECT_EQ(1, nb_init_shared(name.c_str(), nbbs_total_memory));
+        EXPECT_EQ(1, nb_attach_shared("/nbbs-test-does-not-exist"));
+
+        /* Re-attach to the segment created above */
+        ASSERT_EQ(0, nb_attach_shared(name.c_str()));
+        EXPECT_EQ(nbbs_total_memory, nb_stat_total_memory());
+
+        uint64_t parent = nb_alloc_offset(nbbs_min_size);
+        ASSERT_NE(NB_INVALID_OFFSET, parent);
+
+        std::vector<pid_t> children = {};
+        for (int i = 0; i < nbbs_thread_count; i++) {
+                pid_t pid = fork();
+                ASSERT_LE(0, pid);
+
+                if (pid == 0) {
+                        /* Half inherit the mapping, half map it again */
+                        if (i % 2 && nb_attach_shared(name.c_str())) {
+                                _exit(2);
+                        }
+
+                        _exit(worker(i + 1, &kept[i]));
+                }
+
+                children.push_back(pid);
+        }
+
+        for (pid_t pid : children) {
+                int status = 0;
+                ASSERT_EQ(pid, waitpid(pid, &status, 0));
+                EXPECT_TRUE(WIFEXITED(status));
+                EXPECT_EQ(0, WEXITSTATUS(status));
+        }
+
+        /* Counters are shared as well */
+        uint64_t total = nbbs_min_size;
+        for (int i = 0; i < nbbs_thread_count; i++) {
+                total += kept[i];
+        }
+        EXPECT_EQ(total, nb_stat_used_memory());
+
+        nb_free_offset(parent);
+        EXPECT_EQ(total - nbbs_min_size, nb_stat_used_memory());
+
+        shm_unlink(name.c_str());
+        munmap(kept, nbbs_thread_count * sizeof(uint64_t));
+}
+
+TEST(NBBS, shared_failure)
+{
+        std::string name = "/nbbs-test-fail-" + std::to_string(getpid());
+
+        pid_t pid = fork();
+        ASSERT_LE(0, pid);
+
+        if (pid == 0) {
+                if (nb_init_shared(0, nbbs_total_memory)) {
+                        _exit(2);
+                }
+                nb_free_offset(nb_alloc_offset(nbbs_min_size));
+
+                /* The segment can't be mapped */
+                struct rlimit limit = {0, 0};
+                getrlimit(RLIMIT_AS, &limit);
+                limit.rlim_cur = 0;
+                setrlimit(RLIMIT_AS, &limit);
+
+                if (!nb_init_shared(name.c_str(), 2 * nbbs_total_memory)) {
+                        _exit(3);
+                }
+
+                /* Still the old arena; the object is gone */
+                if (nb_stat_total_memory() != nbbs_total_memory ||
+                        nb_alloc_offset(nbbs_min_size) == NB_INVALID_OFFSET) {
+                        _exit(4);
+                }
+
+                _exit(shm_open(name.c_str(), O_RDWR, 0600) < 0 ? 0 : 5);
+        }
+
+        int status = 0;
+        ASSERT_EQ(pid, waitpid(pid, &status, 0));
+        EXPECT_TRUE(WIFEXITED(status));
+        EXPECT_EQ(0, WEXITSTATUS(status));
+
+        shm_unlink(name.c_str());
+}
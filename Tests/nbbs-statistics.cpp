@@ -30,7 +30,7 @@ TEST(NBBS, statistics)
         EXPECT_EQ(std::exp2(nbbs_depth + 1), nb_stat_tree_size());
 
         /* nb_stat_index_size() */
-        EXPECT_EQ((nbbs_total_memory / nbbs_min_size) * sizeof(uint32_t),
+        EXPECT_EQ((nbbs_total_memory / nbbs_min_size) * sizeof(nb_node_t),
                 nb_stat_index_size()
         );
 
@@ -0,0 +1,97 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+struct nbbs_stress_block {
+        uint64_t *addr;
+        uint64_t words;
+        uint64_t tag;
+};
+
+static std::atomic<uint64_t> nbbs_stress_errors(0);
+
+/* Random allocs & frees of mixed orders; every block carries a tag */
+static void thread_stress(int id)
+{
+        std::mt19937 rng(id);
+        std::uniform_int_distribution<> order_dis(0, 4);
+        std::vector<nbbs_stress_block> live = {};
+
+        for (int i = 0; i < 20 * nbbs_iter_count; i++) {
+                if (live.size() < 64 && (live.empty() || rng() % 2)) {
+                        uint64_t size = nbbs_min_size << order_dis(rng);
+                        uint64_t *addr = (uint64_t*) nb_alloc(size);
+                        if (!addr) {
+                                continue;
+                        }
+
+                        uint64_t words = size / sizeof(uint64_t);
+                        uint64_t tag = ((uint64_t) id << 32) | i;
+
+                        addr[0] = tag;
+                        addr[words / 2] = tag;
+                        addr[words - 1] = tag;
+                        live.push_back({addr, words, tag});
+                } else {
+                        size_t n = rng() % live.size();
+                        nbbs_stress_block block = live[n];
+
+                        /* No one but the owner should've accessed it */
+                        if (block.addr[0] != block.tag ||
+                                block.addr[block.words / 2] != block.tag ||
+                                block.addr[block.words - 1] != block.tag) {
+                                nbbs_stress_errors++;
+                        }
+
+                        nb_free(block.addr);
+                        live[n] = live.back();
+                        live.pop_back();
+                }
+        }
+
+        for (auto &block : live) {
+                nb_free(block.addr);
+        }
+}
+
+TEST(NBBS, stress)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        nbbs_stress_errors = 0;
+
+        std::vector<std::thread> threads = {};
+        for (int i = 0; i < nbbs_thread_count; i++) {
+                threads.push_back(std::thread(thread_stress, i + 1));
+        }
+        for (std::thread &thread : threads) {
+                thread.join();
+        }
+
+        EXPECT_EQ(0ULL, nbbs_stress_errors.load());
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+
+        /* Every release coalesced back up to the base level */
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size,
+                nb_stat_free_blocks(nbbs_max_order));
+
+        std::vector<uint8_t> map(nb_stat_total_blocks(0));
+        EXPECT_EQ(0, nb_stat_occupancy_map(map.data(), 0));
+        for (auto occupied : map) {
+                ASSERT_EQ(0, occupied);
+        }
+
+        std::free(playground);
+}
@@ -0,0 +1,85 @@
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+#if NB_TAGS
+
+TEST(NBBS, tags)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+        EXPECT_EQ(0ULL, nb_stat_tag_usage(1));
+        EXPECT_EQ(0ULL, nb_stat_tag_blocks(1));
+
+        /* Out of range */
+        EXPECT_EQ((void*) 0, nb_alloc_tagged(nbbs_min_size, NB_TAGS));
+        EXPECT_EQ(0ULL, nb_stat_tag_usage(NB_TAGS));
+
+        void *page = nb_alloc_tagged(nbbs_min_size, 1);
+        void *pair = nb_alloc_tagged(3 * nbbs_min_size, 1);
+        void *max = nb_alloc_tagged(nbbs_max_size, 2);
+        ASSERT_NE((void*) 0, page);
+        ASSERT_NE((void*) 0, pair);
+        ASSERT_NE((void*) 0, max);
+
+        EXPECT_EQ(5 * nbbs_min_size, nb_stat_tag_usage(1));
+        EXPECT_EQ(2ULL, nb_stat_tag_blocks(1));
+        EXPECT_EQ((uint64_t) nbbs_max_size, nb_stat_tag_usage(2));
+        EXPECT_EQ(1ULL, nb_stat_tag_blocks(2));
+
+        /* Untagged blocks aren't charged */
+        void *untagged = nb_alloc_tagged(nbbs_min_size, 0);
+        void *plain = nb_alloc(nbbs_min_size);
+        EXPECT_EQ(0ULL, nb_stat_tag_usage(0));
+
+        nb_free(pair);
+        EXPECT_EQ(nbbs_min_size, nb_stat_tag_usage(1));
+        EXPECT_EQ(1ULL, nb_stat_tag_blocks(1));
+
+        /* Tags don't stick to the pages */
+        nb_free(page);
+        void *reused = nb_alloc(nbbs_min_size);
+        EXPECT_EQ((uint64_t) page, (uint64_t) reused);
+        nb_free(reused);
+        EXPECT_EQ(0ULL, nb_stat_tag_usage(1));
+        EXPECT_EQ(0ULL, nb_stat_tag_blocks(1));
+
+        nb_free(max);
+        nb_free(untagged);
+        nb_free(plain);
+        EXPECT_EQ(0ULL, nb_stat_tag_usage(2));
+
+        /* Frees from other threads land on other shards; sums still match */
+        std::vector<void*> allocs(nbbs_thread_count);
+        std::vector<std::thread> threads = {};
+        for (int i = 0; i < nbbs_thread_count; i++) {
+                threads.push_back(std::thread([&allocs, i]() {
+                        allocs[i] = nb_alloc_tagged(nbbs_min_size, 3);
+                }));
+        }
+        for (std::thread &thread : threads) {
+                thread.join();
+        }
+
+        EXPECT_EQ(nbbs_thread_count * nbbs_min_size, nb_stat_tag_usage(3));
+        for (void *alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(0ULL, nb_stat_tag_usage(3));
+        EXPECT_EQ(0ULL, nb_stat_tag_blocks(3));
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        std::free(playground);
+}
+
+#endif
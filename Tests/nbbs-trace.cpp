@@ -0,0 +1,132 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+#if NB_TRACE
+
+static std::vector<nb_trace_event> dump(nb_trace_header &header)
+{
+        FILE *file = std::tmpfile();
+        EXPECT_NE((FILE*) 0, file);
+        EXPECT_EQ(0, nb_trace_dump(fileno(file)));
+
+        std::vector<nb_trace_event> events = {};
+        std::rewind(file);
+
+        EXPECT_EQ(1ULL, std::fread(&header, sizeof(header), 1, file));
+
+        nb_trace_event event;
+        while (std::fread(&event, sizeof(event), 1, file) == 1) {
+                events.push_back(event);
+        }
+        std::fclose(file);
+
+        return events;
+}
+
+TEST(NBBS, trace)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Off by default */
+        nb_trace_header header;
+        nb_free(nb_alloc(nbbs_min_size));
+        EXPECT_EQ(0ULL, dump(header).size());
+
+        EXPECT_EQ(NB_TRACE_MAGIC, header.magic);
+        EXPECT_EQ(nbbs_min_size, header.min_size);
+        EXPECT_EQ(nbbs_total_memory, header.total_memory);
+        EXPECT_EQ(nbbs_max_order, header.max_order);
+        EXPECT_EQ(NB_POLICY_FIRST_FIT, header.policy);
+
+        nb_set_trace(1);
+
+        void *page = nb_alloc(nbbs_min_size);
+        void *pair = nb_alloc_flags(3 * nbbs_min_size, NB_ALLOC_MOVABLE);
+        nb_free(page);
+        EXPECT_EQ((void*) 0, nb_alloc(2 * nbbs_total_memory));
+
+        std::vector<nb_trace_event> events = dump(header);
+        ASSERT_EQ(4ULL, events.size());
+
+        EXPECT_EQ(NB_TRACE_ALLOC, events[0].op);
+        EXPECT_EQ(nbbs_min_size, events[0].size);
+        EXPECT_EQ((uint64_t) page - (uint64_t) playground, events[0].block);
+
+        EXPECT_EQ(NB_TRACE_ALLOC, events[1].op);
+        EXPECT_EQ(3 * nbbs_min_size, events[1].size);
+        EXPECT_EQ(NB_ALLOC_MOVABLE, events[1].flags);
+
+        EXPECT_EQ(NB_TRACE_FREE, events[2].op);
+        EXPECT_EQ(events[0].block, events[2].block);
+
+        EXPECT_EQ(NB_INVALID_OFFSET, events[3].block);
+
+        for (uint32_t i = 1; i < events.size(); i++) {
+                EXPECT_EQ(events[0].thread, events[i].thread);
+                EXPECT_LE(events[i - 1].ticks, events[i].ticks);
+        }
+
+        /* Freed by another thread, after the allocation */
+        uint32_t self = events[0].thread;
+        nb_trace_event allocated = events[1];
+
+        std::thread([pair]() {
+                nb_free(pair);
+        }).join();
+
+        events = dump(header);
+        ASSERT_EQ(5ULL, events.size());
+
+        uint32_t others = 0;
+        for (nb_trace_event &event : events) {
+                if (event.thread == self) {
+                        continue;
+                }
+
+                others++;
+                EXPECT_EQ(NB_TRACE_FREE, event.op);
+                EXPECT_EQ(allocated.block, event.block);
+                EXPECT_LT(allocated.ticks, event.ticks);
+        }
+        EXPECT_EQ(1U, others);
+
+        /* The ring keeps the newest events */
+        for (uint32_t i = 0; i < NB_TRACE; i++) {
+                nb_free(nb_alloc(nbbs_min_size));
+        }
+
+        events = dump(header);
+        EXPECT_EQ(NB_TRACE + 1ULL, events.size());
+        EXPECT_EQ(NB_TRACE_FREE, events.back().op);
+
+        /* A new trace drops the old events */
+        nb_set_trace(1);
+        nb_free_deferred(nb_alloc(nbbs_min_size));
+        nb_reclaim();
+
+        events = dump(header);
+        ASSERT_EQ(2ULL, events.size());
+        EXPECT_EQ(NB_TRACE_FREE, events[1].op);
+
+        nb_set_trace(0);
+        nb_free(nb_alloc(nbbs_min_size));
+        EXPECT_EQ(2ULL, dump(header).size());
+
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+        std::free(playground);
+}
+
+#endif
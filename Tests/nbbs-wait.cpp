@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "nbbs-defs.h"
+#include "nbbs.hpp"
+
+/* Minimal fire & forget coroutine */
+struct task {
+        struct promise_type {
+                task get_return_object() { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { std::terminate(); }
+        };
+};
+
+static task waiting_alloc(std::atomic<void*>& result,
+        std::thread::id *resumed = nullptr)
+{
+        void *addr = co_await nbbs::alloc(nbbs_max_size);
+        if (resumed) {
+                *resumed = std::this_thread::get_id();
+        }
+        result = addr;
+}
+
+TEST(NBBS, wait)
+{
+        using namespace std::chrono;
+
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Available right away */
+        void *alloc = nb_alloc_wait(nbbs_min_size, 0);
+        ASSERT_NE((void*) 0, alloc);
+        nb_free(alloc);
+
+        /* Too large to ever succeed */
+        EXPECT_EQ((void*) 0, nb_alloc_wait(nbbs_max_size + 1, NB_WAIT_FOREVER));
+
+        /* Exhaust the memory */
+        std::vector<void*> allocs = {};
+        while ((alloc = nb_alloc(nbbs_max_size))) {
+                allocs.push_back(alloc);
+        }
+
+        /* Times out */
+        auto start = steady_clock::now();
+        EXPECT_EQ((void*) 0, nb_alloc_wait(nbbs_min_size, 20 * 1000 * 1000));
+        EXPECT_LE(20, duration_cast<milliseconds>(
+                steady_clock::now() - start).count());
+
+        /* Woken by a release */
+        std::atomic<void*> waited = nullptr;
+        std::thread waiter([&waited]() {
+                waited = nb_alloc_wait(nbbs_min_size, NB_WAIT_FOREVER);
+        });
+
+        std::this_thread::sleep_for(milliseconds(20));
+        EXPECT_EQ((void*) 0, waited.load());
+
+        void *released = allocs.back();
+        allocs.pop_back();
+        nb_free(released);
+
+        waiter.join();
+        EXPECT_EQ(released, waited.load());
+        nb_free(waited);
+
+        /* Coroutine; suspended until a max order block is released */
+        void *taken = nb_alloc(nbbs_max_size);
+        ASSERT_NE((void*) 0, taken);
+
+        std::atomic<void*> awaited = nullptr;
+        waiting_alloc(awaited);
+
+        std::this_thread::sleep_for(milliseconds(20));
+        EXPECT_EQ((void*) 0, awaited.load());
+
+        nb_free(taken);
+        while (!awaited) {
+                std::this_thread::sleep_for(milliseconds(1));
+        }
+        EXPECT_EQ(taken, awaited.load());
+
+        /* Several coroutines share one waiter thread */
+        void *second = allocs.back();
+        allocs.pop_back();
+
+        std::atomic<void*> first_awaited = nullptr;
+        std::atomic<void*> second_awaited = nullptr;
+        std::thread::id first_id, second_id;
+        waiting_alloc(first_awaited, &first_id);
+        waiting_alloc(second_awaited, &second_id);
+
+        nb_free(awaited);
+        nb_free(second);
+        while (!first_awaited || !second_awaited) {
+                std::this_thread::sleep_for(milliseconds(1));
+        }
+        EXPECT_EQ(first_id, second_id);
+        EXPECT_NE(std::this_thread::get_id(), first_id);
+
+        awaited = first_awaited.load();
+        nb_free(second_awaited);
+        nb_free(awaited);
+        for (auto alloc : allocs) {
+                nb_free(alloc);
+        }
+        EXPECT_EQ(0ULL, nb_stat_used_memory());
+
+        std::free(playground);
+}
@@ -0,0 +1,108 @@
+#include "gtest/gtest.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+static std::vector<std::pair<uint32_t, uint32_t>> events = {};
+
+static void on_watermark(uint32_t order, uint32_t event, void *ctx)
+{
+        EXPECT_EQ((void*) &events, ctx);
+        events.push_back({order, event});
+}
+
+TEST(NBBS, watermark)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Invalid */
+        EXPECT_EQ(1, nb_set_watermark(nbbs_max_order + 1, 0, 0));
+        EXPECT_EQ(1, nb_set_watermark(0, 2, 1));
+
+        /* Keep 4 max order blocks in reserve; recover at 8 */
+        ASSERT_EQ(0, nb_set_watermark(nbbs_max_order,
+                4 * nbbs_max_size, 8 * nbbs_max_size));
+        nb_set_watermark_callback(on_watermark, &events);
+
+        int efd = nb_watermark_eventfd();
+        ASSERT_LE(0, efd);
+
+        /* Normal allocations stop at the low watermark */
+        std::vector<void*> allocs = {};
+        void *alloc = 0;
+        while ((alloc = nb_alloc(nbbs_max_size))) {
+                allocs.push_back(alloc);
+        }
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size - 4, allocs.size());
+
+        ASSERT_EQ(1ULL, events.size());
+        EXPECT_EQ(nbbs_max_order, events[0].first);
+        EXPECT_EQ(NB_WMARK_LOW, events[0].second);
+
+        /* Other orders are not limited */
+        alloc = nb_alloc(nbbs_min_size);
+        ASSERT_NE((void*) 0, alloc);
+        nb_free(alloc);
+
+        /* Privileged ones dip into the reserve */
+        while ((alloc = nb_alloc_flags(nbbs_max_size, NB_ALLOC_RESERVE))) {
+                allocs.push_back(alloc);
+        }
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size, allocs.size());
+        EXPECT_EQ(1ULL, events.size());
+
+        /* Recovers at the high watermark */
+        for (int i = 0; i < 7; i++) {
+                nb_free(allocs.back());
+                allocs.pop_back();
+        }
+        EXPECT_EQ(1ULL, events.size());
+
+        nb_free(allocs.back());
+        allocs.pop_back();
+
+        ASSERT_EQ(2ULL, events.size());
+        EXPECT_EQ(nbbs_max_order, events[1].first);
+        EXPECT_EQ(NB_WMARK_HIGH, events[1].second);
+
+        uint64_t count = 0;
+        ASSERT_EQ((ssize_t) sizeof(count), read(efd, &count, sizeof(count)));
+        EXPECT_EQ(2ULL, count);
+
+        /* Removed */
+        ASSERT_EQ(0, nb_set_watermark(nbbs_max_order, 0, 0));
+        while ((alloc = nb_alloc(nbbs_max_size))) {
+                allocs.push_back(alloc);
+        }
+        EXPECT_EQ(nbbs_total_memory / nbbs_max_size, allocs.size());
+        EXPECT_EQ(2ULL, events.size());
+
+        for (auto alloc : allocs) {
+                nb_free(alloc);
+        }
+        allocs.clear();
+
+        /* A refusal signals the order even above the low watermark */
+        events.clear();
+        ASSERT_EQ(0, nb_set_watermark(nbbs_max_order, nbbs_total_memory,
+                nbbs_total_memory));
+        EXPECT_EQ((void*) 0, nb_alloc(nbbs_max_size));
+
+        ASSERT_EQ(1ULL, events.size());
+        EXPECT_EQ(nbbs_max_order, events[0].first);
+        EXPECT_EQ(NB_WMARK_LOW, events[0].second);
+        ASSERT_EQ(0, nb_set_watermark(nbbs_max_order, 0, 0));
+
+        nb_set_watermark_callback(0, 0);
+        std::free(playground);
+}
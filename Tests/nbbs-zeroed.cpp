@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "nbbs-defs.h"
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+static bool is_zero(uint8_t *addr, uint64_t size)
+{
+        return std::all_of(addr, addr + size,
+                [](uint8_t v) { return v == 0; });
+}
+
+TEST(NBBS, zeroed)
+{
+        uint8_t *playground = static_cast<uint8_t*>(
+                std::aligned_alloc(nbbs_max_size, nbbs_total_memory)
+        );
+        std::fill_n(playground, nbbs_total_memory / sizeof(uint8_t), 0xFF);
+
+        EXPECT_EQ(0, nb_init((uint64_t) playground, nbbs_total_memory));
+
+        /* Arena contents are unknown */
+        uint8_t *block = (uint8_t*) nb_alloc_zeroed(nbbs_min_size);
+        ASSERT_NE((void*) 0, block);
+        EXPECT_TRUE(is_zero(block, nbbs_min_size));
+
+        /* Freed blocks are dirty */
+        std::fill_n(block, nbbs_min_size, 0xAA);
+        nb_free(block);
+
+        block = (uint8_t*) nb_alloc_zeroed(nbbs_min_size);
+        ASSERT_NE((void*) 0, block);
+        EXPECT_TRUE(is_zero(block, nbbs_min_size));
+        nb_free(block);
+
+        /* Large blocks (non-temporal path) */
+        block = (uint8_t*) nb_alloc_zeroed(nbbs_max_size);
+        ASSERT_NE((void*) 0, block);
+        EXPECT_TRUE(is_zero(block, nbbs_max_size));
+
+        /* Plain allocations are not cleared */
+        uint8_t *plain = (uint8_t*) nb_alloc(nbbs_max_size);
+        ASSERT_NE((void*) 0, plain);
+        EXPECT_EQ(0xFF, plain[0]);
+        nb_free(plain);
+        nb_free(block);
+
+        /* Scrub the first two max order blocks in the background */
+        EXPECT_EQ(2 * nbbs_max_size, nb_scrub(2 * nbbs_max_size));
+        EXPECT_TRUE(is_zero(playground, 2 * nbbs_max_size));
+        EXPECT_EQ(0xFF, playground[2 * nbbs_max_size]);
+
+        /* Never more than the budget; continues after the last block */
+        EXPECT_EQ(nbbs_min_size, nb_scrub(nbbs_min_size));
+        EXPECT_EQ(0, playground[2 * nbbs_max_size]);
+        EXPECT_EQ(0xFF, playground[2 * nbbs_max_size + nbbs_min_size]);
+
+        EXPECT_EQ(nbbs_min_size, nb_scrub(nbbs_min_size));
+        EXPECT_EQ(0, playground[3 * nbbs_max_size]);
+        EXPECT_EQ(0xFF, playground[2 * nbbs_max_size + nbbs_min_size]);
+
+        /* Already known to be zero */
+        std::fill_n(playground, nbbs_min_size, 0xBB);
+        block = (uint8_t*) nb_alloc_zeroed(nbbs_min_size);
+        EXPECT_EQ(playground, block);
+        EXPECT_EQ(0xBB, block[0]);
+        nb_free(block);
+
+        std::free(playground);
+
+        /* Fresh mmap arena is never touched */
+        ASSERT_EQ(0, nb_init_mmap(nbbs_total_memory));
+
+        block = (uint8_t*) nb_alloc_zeroed(nbbs_max_size);
+        ASSERT_NE((void*) 0, block);
+
+        std::vector<unsigned char> vec(nbbs_max_size / sysconf(_SC_PAGESIZE));
+        ASSERT_EQ(0, mincore(block, nbbs_max_size, vec.data()));
+        EXPECT_TRUE(std::none_of(vec.begin(), vec.end(),
+                [](unsigned char v) { return v & 1; }));
+        EXPECT_TRUE(is_zero(block, nbbs_max_size));
+}
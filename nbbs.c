@@ -2,55 +2,454 @@
  * This file (NBSS.c) implements the Non-Blocking Buddy System
  */
 
+#define _GNU_SOURCE
+
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if __x86_64__
+        #include <emmintrin.h>
+#endif
+
+#if (NB_INSTRUMENT || NB_TRACE) && __x86_64__
+        #include <x86intrin.h>
+#endif
+
+#if NB_PROFILE
+        #include <execinfo.h>
+        #include <math.h>
+        #include <stdio.h>
+#endif
+
+#if __linux__
+        #include <linux/futex.h>
+        #include <sys/eventfd.h>
+        #include <sys/syscall.h>
+#endif
 
 #include "nbbs.h"
 
+/*
+ * USDT probes (provider nbbs); a nop unless a tracer is attached. Define
+ * NB_USDT=0 to leave them out. Semaphores tell whether a probe is in use,
+ * so arguments that cost something are only computed then.
+ */
+#ifndef NB_USDT
+        #if defined(__has_include)
+                #if __has_include(<sys/sdt.h>)
+                        #define NB_USDT 1
+                #endif
+        #endif
+#endif
+
+#if NB_USDT
+        #define _SDT_HAS_SEMAPHORES 1
+        #include <sys/sdt.h>
+
+        #define NB_PROBE_SEMAPHORE(name) \
+                unsigned short nbbs_##name##_semaphore \
+                __attribute__((unused, section(".probes")))
+        #define NB_PROBE_ENABLED(name) \
+                __builtin_expect(nbbs_##name##_semaphore, 0)
+
+        #define NB_PROBE1(name, a) DTRACE_PROBE1(nbbs, name, a)
+        #define NB_PROBE2(name, a, b) DTRACE_PROBE2(nbbs, name, a, b)
+        #define NB_PROBE3(name, a, b, c) DTRACE_PROBE3(nbbs, name, a, b, c)
+        #define NB_PROBE4(name, a, b, c, d) \
+                DTRACE_PROBE4(nbbs, name, a, b, c, d)
+
+        NB_PROBE_SEMAPHORE(alloc_entry);
+        NB_PROBE_SEMAPHORE(alloc_exit);
+        NB_PROBE_SEMAPHORE(free_entry);
+        NB_PROBE_SEMAPHORE(free_exit);
+        NB_PROBE_SEMAPHORE(cas_fail);
+        NB_PROBE_SEMAPHORE(restart);
+        NB_PROBE_SEMAPHORE(oom);
+#else
+        #define NB_PROBE_ENABLED(name) 0
+
+        /* Arguments are side effect free; keeps them "used" */
+        #define NB_PROBE1(name, a) do { (void) (a); } while (0)
+        #define NB_PROBE2(name, a, b) \
+                do { (void) (a); (void) (b); } while (0)
+        #define NB_PROBE3(name, a, b, c) \
+                do { (void) (a); (void) (b); (void) (c); } while (0)
+        #define NB_PROBE4(name, a, b, c, d) \
+                do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
+#endif
+
 /* Meta-data */
 static uint8_t *nb_tree = 0;
-static uint32_t *nb_index = 0;
+static nb_node_t *nb_index = 0;
 
 static uint64_t nb_tree_size = 0; /* bytes */
 static uint64_t nb_index_size = 0; /* bytes */
 
+/* Pages of free blocks that are not known to be zero; one bit per page */
+static uint64_t *nb_dirty = 0;
+static uint64_t nb_dirty_size = 0; /* bytes */
+
 static uint64_t nb_base_address = 0;
 static uint64_t nb_total_memory = 0;
 static uint32_t nb_depth = 0;
 static uint64_t nb_base_level = 0;
 static uint64_t nb_max_size = 0;
-static uint32_t nb_release_count = 0;
+
+/*
+ * Header; process local unless the allocator lives in a shared segment.
+ * Everything that changes after initialization is kept here.
+ */
+struct nb_header {
+        /* Segment layout (see nb_init_shared & nb_open_file) */
+        uint64_t magic;
+        uint32_t version;
+        uint32_t max_order;
+        uint64_t min_size;
+        uint64_t size; /* arena bytes */
+        uint64_t tree_offset;
+        uint64_t index_offset;
+        uint64_t dirty_offset;
+        uint64_t arena_offset;
+        uint64_t segment_size;
+        uint64_t node_size; /* bytes; see NB_NODE_64 */
+        uint64_t checksum; /* of the fields above */
+        uint32_t clean; /* closed properly; no recovery needed */
+
+        /* Counters */
+        uint32_t release_count;
+        uint64_t alloc_blocks[NB_MAX_ORDER + 1];
+        uint64_t reserved_bytes; /* see nb_reserve_range */
+
+        /* Deferred releases (see nb_free_deferred) */
+        uint64_t deferred_head; /* arena offset + 1; 0 if empty */
+        uint64_t deferred_bytes;
+
+        /* Blocked allocations (see nb_alloc_wait) */
+        uint32_t waiters;
+        uint32_t order_waiters[NB_MAX_ORDER + 1];
+        uint32_t wake_seq[NB_MAX_ORDER + 1]; /* futex words */
+
+        /* Scan hints per order (see NB_SCAN_HINT); 0 for the level start */
+        nb_node_t first_free[NB_MAX_ORDER + 1];
+};
+
+static struct nb_header nb_local_header = {0};
+static struct nb_header *nb_header = &nb_local_header;
+
+#define NB_SEGMENT_MAGIC 0x4d47455353424eULL /* "NBSSEGM" */
+#define NB_SEGMENT_VERSION 5U
+
+/* Flags in the top bits of index entries; node ids stay below them */
+#define NB_INDEX_FLAGS 2U
+#define NB_INDEX_BITS (sizeof(nb_node_t) * 8 - NB_INDEX_FLAGS)
+
+/* Index entries of reserved blocks; nb_free ignores them */
+#define NB_INDEX_RESERVED ((nb_node_t) 1 << (sizeof(nb_node_t) * 8 - 1))
+
+/* Reserved by nb_offline_region; the only ones nb_add_region releases */
+#define NB_INDEX_OFFLINE (NB_INDEX_RESERVED | \
+        ((nb_node_t) 1 << (sizeof(nb_node_t) * 8 - 2)))
+
+/* Arena (see nb_init_mmap) */
+static uint8_t nb_arena_mmap = 0;
+static uint8_t *nb_commit_map = 0; /* one byte per base level block */
+static uint32_t nb_release_order = NB_RELEASE_ORDER;
+static uint64_t nb_release_interval = NB_RELEASE_INTERVAL;
+static uint64_t nb_release_last = 0;
+static nb_node_t nb_release_pending[NB_RELEASE_PENDING] = {0}; /* lost the slot */
+
+/* Watermarks (see nb_set_watermark); bytes of free memory */
+static uint64_t nb_wmark_low[NB_MAX_ORDER + 1] = {0};
+static uint64_t nb_wmark_high[NB_MAX_ORDER + 1] = {0};
+static uint32_t nb_wmark_orders = 0; /* orders with a watermark */
+static uint32_t nb_wmark_below = 0; /* orders below their low watermark */
+static void (*nb_wmark_callback)(uint32_t, uint32_t, void*) = 0;
+static void *nb_wmark_ctx = 0;
+static int nb_wmark_eventfd = -1;
+
+/* Background scrubbing (see nb_scrub) */
+static nb_node_t nb_scrub_cursor = 0;
+
+/* Placement */
+static uint32_t nb_policy = NB_POLICY_FIRST_FIT;
+static uint32_t nb_huge_level = 0;
+
+/* Mobility grouping; one owner type per base level block (hint only) */
+static uint8_t *nb_owner = 0;
+
+/* Mobility type of each block, at its first leaf. Process local */
+static uint8_t *nb_mobility = 0;
+
+#if NB_TAGS
+/* Owner tags; one per leaf, 0 if untagged. Process local */
+static uint16_t *nb_tag = 0;
+
+/* Sharded so that threads don't bounce the same lines */
+struct nb_tag_shard {
+        _Alignas(64) uint64_t bytes[NB_TAGS];
+        uint64_t blocks[NB_TAGS];
+};
+
+static struct nb_tag_shard nb_tag_usage[NB_TAG_SHARDS];
+#endif
+
+#if NB_PROFILE
+/*
+ * Live samples; open addressing, keyed by block address. A slot is claimed
+ * with the low bit of the key set & published once it's filled in.
+ */
+#define NB_SAMPLE_TOMB (~0ULL)
+
+struct nb_sample {
+        uint64_t key;
+        uint64_t size; /* bytes */
+        uint32_t order;
+        uint32_t depth;
+        void *stack[NB_PROFILE_DEPTH];
+};
+
+static struct nb_sample nb_samples[NB_PROFILE_SLOTS];
+static uint64_t nb_profile_rate = NB_PROFILE_RATE;
+static uint32_t nb_profile_epoch = 1; /* bumped when the rate changes */
+static uint64_t nb_profile_live = 0;
+#endif
+
+#if NB_TRACE
+static uint8_t nb_tracing = 0;
+static uint32_t nb_trace_epoch = 1; /* bumped when a new trace starts */
+#endif
+
+/*
+ * Per-thread records; linked once & never freed, so walking the list is
+ * always safe. A record is reused once its thread exits.
+ */
+struct nb_thread {
+        struct nb_thread *next;
+        uint32_t active;
+        uint32_t backoff; /* current window; pauses */
+        uint64_t seed;
+        uint64_t cas_failures[NB_SITES];
+
+        /* Share of the base level blocks (see NB_POLICY_PARTITION) */
+        uint32_t id;
+        uint32_t slot;
+        uint32_t parts;
+        uint32_t epoch;
+
+        /* Flat combining request & contention rate (see __nb_combine) */
+        uint32_t op;
+        uint32_t flags;
+        uint32_t color;
+        uint64_t arg;
+        void *ret;
+        uint8_t combiner;
+        uint64_t ops;
+        uint64_t failures; /* at the last rate check */
+
+        uint32_t next_color; /* see NB_COLOR_NEXT */
+
+        uint64_t sample_left; /* bytes (see NB_PROFILE) */
+        uint32_t sample_epoch; /* rate it was drawn with */
+
+#if NB_INSTRUMENT
+        /* Only written by the thread itself (see nb_stat_histogram) */
+        uint64_t hist[NB_HISTS][NB_HIST_BUCKETS];
+
+        /* Current operation */
+        uint64_t op_scanned;
+        uint64_t op_failures;
+        uint64_t op_restarts;
+        uint64_t op_climbed;
+#endif
+
+#if NB_TRACE
+        /* Ring of the last NB_TRACE events; single writer */
+        struct nb_trace_event *trace;
+        uint64_t trace_head; /* events recorded */
+        uint32_t trace_epoch; /* trace they belong to */
+#endif
+};
+
+#if NB_INSTRUMENT
+        #define NB_COUNT(field, n) \
+                do { if (nb_self) { nb_self->field += (n); } } while (0)
+#else
+        #define NB_COUNT(field, n) do { } while (0)
+#endif
+
+static struct nb_thread *nb_threads = 0;
+static uint32_t nb_thread_count = 0; /* records */
+static uint32_t nb_thread_epoch = 0; /* bumped when a thread comes or goes */
+
+/* Flat combining; requests are published in the thread records */
+#define NB_OP_ALLOC 1U
+#define NB_OP_FREE 2U
+
+/* Uncolored allocation (see nb_alloc_colored) */
+#define NB_COLOR_ANY NB_COLORS
+
+static uint32_t nb_combine_mode = NB_COMBINE_OFF;
+static uint32_t nb_combining = 0; /* engaged */
+static uint32_t nb_combine_lock = 0;
+static uint64_t nb_combine_passes = 0; /* under the lock */
+static uint64_t nb_combine_served = 0; /* under the lock */
+static _Thread_local struct nb_thread *nb_self = 0;
+#if NB_SCAN_HINT
+static _Thread_local uint8_t nb_scan_unhinted = 0; /* see __nb_alloc */
+#endif
+static pthread_key_t nb_thread_key;
+static pthread_once_t nb_thread_once = PTHREAD_ONCE_INIT;
 
 /* Statistics */
-static uint64_t nb_stat_alloc_blocks[NB_MAX_ORDER + 1] = {0};
+static uint64_t nb_stat_committed = 0; /* bytes */
+static uint64_t nb_stat_released = 0; /* bytes */
+static uint64_t nb_stat_combine = 0; /* operations */
 
-int nb_init(uint64_t base, uint64_t size)
+static uint64_t __nb_align(uint64_t val, uint64_t align)
 {
-        if (base == 0 || size == 0) {
-                return 1;
-        }
+        return (val + align - 1) & ~(align - 1);
+}
 
-        if (size < NB_MIN_SIZE) {
-                return 1;
-        }
+/* Metadata sizes of an arena */
+static void __nb_sizes(uint64_t size, uint64_t *tree_size,
+        uint64_t *index_size, uint64_t *dirty_size)
+{
+        uint32_t depth = LOG2_LOWER(size / NB_MIN_SIZE);
+
+        /* Calculate required tree size - root node is at index 1  */
+        uint64_t total_nodes = EXP2(depth + 1);
 
+        /* Calculate required index size */
+        uint64_t total_pages = (size / NB_MIN_SIZE);
+
+        *tree_size = total_nodes * 1;  // each node is 1 byte
+        *index_size = total_pages * sizeof(nb_node_t); // per leaf
+        *dirty_size = __nb_align(total_pages, 64) / 8;
+}
+
+static void __nb_setup(uint64_t base, uint64_t size)
+{
         /* Setup */
-        nb_base_address = base;       
+        nb_base_address = base;
         nb_total_memory = size;
         
         nb_depth = LOG2_LOWER(nb_total_memory / NB_MIN_SIZE);
         nb_base_level = nb_depth - NB_MAX_ORDER;
         nb_max_size = EXP2(NB_MAX_ORDER) * NB_MIN_SIZE;
 
-        /* Calculate required tree size - root node is at index 1  */
-        uint32_t total_nodes = EXP2(nb_depth + 1);
+        /* Huge pages larger than max size are tracked as base level blocks */
+        uint32_t huge_order = LOG2_LOWER(NB_HUGE_SIZE / NB_MIN_SIZE);
+        if (NB_MAX_ORDER < huge_order) {
+                huge_order = NB_MAX_ORDER;
+        }
+        nb_huge_level = nb_depth - huge_order;
+
+        __nb_sizes(nb_total_memory, &nb_tree_size, &nb_index_size,
+                &nb_dirty_size);
+
+        /* Runtime settings */
+        nb_policy = NB_POLICY_FIRST_FIT;
+        nb_scrub_cursor = 0;
+
+        nb_wmark_orders = 0;
+        nb_wmark_below = 0;
+        nb_wmark_callback = 0;
+        nb_wmark_ctx = 0;
+
+        nb_arena_mmap = 0;
+        nb_release_order = NB_RELEASE_ORDER;
+        nb_release_interval = NB_RELEASE_INTERVAL;
+        nb_release_last = 0;
+        memset((void*) nb_release_pending, 0x0, sizeof(nb_release_pending));
+        nb_stat_committed = 0;
+        nb_stat_released = 0;
+
+#if NB_PROFILE
+        memset((void*) nb_samples, 0x0, sizeof(nb_samples));
+        nb_profile_live = 0;
+#endif
+
+#if NB_TRACE
+        /* Offsets into the old arena are meaningless */
+        FAD_RELAXED(&nb_trace_epoch, 1);
+#endif
+}
 
-        /* Calculate required index size */
-        uint32_t total_pages = (nb_total_memory / NB_MIN_SIZE);
+#if NB_TAGS
+/* Tags are per process; tagged allocations are untagged without them */
+static uint16_t* __nb_tag_map()
+{
+        uint64_t size = nb_total_memory / NB_MIN_SIZE * sizeof(uint16_t);
+
+        uint16_t *tag = (uint16_t*) NB_MALLOC(size);
+        if (tag) {
+                memset((void*) tag, 0x0, size);
+        }
+
+        memset((void*) nb_tag_usage, 0x0, sizeof(nb_tag_usage));
+
+        return tag;
+}
+#endif
+
+/* Owners are per process; grouping is disabled without them */
+static uint8_t* __nb_owner_map()
+{
+        /* No base level blocks */
+        if (nb_depth < NB_MAX_ORDER) {
+                return 0;
+        }
+
+        uint8_t *owner = (uint8_t*) NB_MALLOC(EXP2(nb_base_level));
+        if (owner) {
+                memset((void*) owner, 0x0, EXP2(nb_base_level));
+        }
+
+        return owner;
+}
+
+/* Blocks of other processes are never relocated; see nb_compact */
+static uint8_t* __nb_mobility_map()
+{
+        uint64_t size = nb_total_memory / NB_MIN_SIZE;
+
+        uint8_t *mobility = (uint8_t*) NB_MALLOC(size);
+        if (mobility) {
+                memset((void*) mobility, 0x0, size);
+        }
+
+        return mobility;
+}
+
+/* Every node id of the tree fits below the index flags */
+static uint8_t __nb_fits(uint64_t size)
+{
+        return NB_MIN_SIZE <= size &&
+                LOG2_LOWER(size / NB_MIN_SIZE) + 1 <= NB_INDEX_BITS;
+}
+
+int nb_init(uint64_t base, uint64_t size)
+{
+        if (base == 0 || size == 0) {
+                return 1;
+        }
+
+        if (!__nb_fits(size)) {
+                return 1;
+        }
 
-        nb_tree_size = total_nodes * 1;  // each node is 1 byte
-        nb_index_size = total_pages * 4; // each leaf index is 4 byte
+        __nb_setup(base, size);
 
         /* Allocate */
         nb_tree = (uint8_t*) NB_MALLOC(nb_tree_size);
@@ -58,274 +457,3256 @@ int nb_init(uint64_t base, uint64_t size)
                 return 1;
         }
 
-        nb_index = (uint32_t*) NB_MALLOC(nb_index_size);
+        nb_index = (nb_node_t*) NB_MALLOC(nb_index_size);
 
         if (!nb_index) {
                 return 1;
         }
 
+        nb_dirty = (uint64_t*) NB_MALLOC(nb_dirty_size);
+        if (!nb_dirty) {
+                return 1;
+        }
+
+        nb_owner = __nb_owner_map();
+        nb_mobility = __nb_mobility_map();
+
+#if NB_TAGS
+        nb_tag = __nb_tag_map();
+        if (!nb_tag) {
+                return 1;
+        }
+#endif
+
         /* Initialize */
         memset((void*) nb_tree, 0x0, nb_tree_size);
         memset((void*) nb_index, 0x0, nb_index_size);
-        memset((void*) nb_stat_alloc_blocks, 0x0, ((NB_MAX_ORDER + 1) * 8));
-        // ------------------------------------------- sizeof(uint64_t) ^
-        nb_release_count = 0;
+
+        /* Contents of the arena are unknown */
+        memset((void*) nb_dirty, 0xFF, nb_dirty_size);
+
+        nb_header = &nb_local_header;
+        memset((void*) nb_header, 0x0, sizeof(struct nb_header));
 
         return 0;
 }
 
-uint32_t __nb_try_alloc(uint32_t node)
+int nb_init_mmap(uint64_t size)
 {
-        /* Occupy the node */
-        uint8_t free = 0;
-        if (!BCAS(&nb_tree[node], &free, BUSY)) {
-                return node;
+        uint64_t align = EXP2(NB_MAX_ORDER) * NB_MIN_SIZE;
+
+        /* Commit granularity is a base level block */
+        if (size < align) {
+                return 1;
         }
 
-        uint32_t current = node;
-        uint32_t child = 0;
+        /* Reserve address space only; pages are committed on first use */
+        uint8_t *map = (uint8_t*) mmap(0, size + align, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) {
+                return 1;
+        }
 
-        /* Propagate the info about the occupancy up to the ancestor node(s) */
-        while (nb_base_level < nb_level(current)) {
-                child = current;
-                current = current >> 1;
+        uint64_t base = ((uint64_t) map + align - 1) & ~(align - 1);
 
-                uint8_t curr_val = 0;
-                uint8_t new_val = 0;
+        if (nb_init(base, size)) {
+                munmap(map, size + align);
+                return 1;
+        }
 
-                do {
-                        curr_val = nb_tree[current];
+        nb_commit_map = (uint8_t*) NB_MALLOC(EXP2(nb_base_level));
+        if (!nb_commit_map) {
+                munmap(map, size + align);
+                return 1;
+        }
 
-                        if (curr_val & OCC) {
-                                __nb_freenode(node, nb_level(child));
-                                return current;
-                        }
+        memset((void*) nb_commit_map, 0x0, EXP2(nb_base_level));
+        nb_arena_mmap = 1;
 
-                        new_val = nb_clean_coal(curr_val, child);
-                        new_val = nb_mark(new_val, child);
-                } while (!BCAS(&nb_tree[current], &curr_val, new_val));
-        }
+        /* Fresh anonymous memory is zero filled */
+        memset((void*) nb_dirty, 0x0, nb_dirty_size);
 
         return 0;
 }
 
-/* TODO: Ugly code; refactor */
-uint32_t __nb_leftmost(uint32_t node, uint32_t depth)
+/* Largest aligned block starting at the leaf that fits before the end */
+static uint32_t __nb_range_order(uint64_t leaf, uint64_t end)
 {
-        /* Index to level */
-        uint32_t level = nb_level(node);
-
-        /* Size (in terms of leaf size) */
-        uint64_t block_size = EXP2(depth - level);
-
-        /* Offset within level */
-        uint64_t offset = node % EXP2(level);
-
-        /* Leftmost leaf */
-        uint32_t leftmost_leaf = EXP2(depth) + offset * block_size;
+        uint32_t order = leaf ? (uint32_t) __builtin_ctzll(leaf) : NB_MAX_ORDER;
 
-        return leftmost_leaf;
-}
+        if (NB_MAX_ORDER < order) {
+                order = NB_MAX_ORDER;
+        }
+        if (nb_depth < order) {
+                order = nb_depth;
+        }
 
-void __nb_clean_block(void* addr, uint64_t size)
-{
-        if (!addr || !size) {
-                return;
+        while (end - leaf < EXP2(order)) {
+                order--;
         }
 
-        memset(addr, 0x0, size);
+        return order;
 }
 
-void* nb_alloc(uint64_t size)
-{
-        if (nb_max_size < size) {
-                return 0;
-        }
+static void __nb_notify(nb_node_t node);
 
-        if (size < NB_MIN_SIZE) {
-                size = NB_MIN_SIZE;
-        }
+/* Releases the reserved blocks covering the pages [start, end) */
+static void __nb_unreserve(uint64_t start, uint64_t end)
+{
+        for (uint64_t leaf = start; leaf < end; ) {
+                uint32_t order = __nb_range_order(leaf, end);
+                nb_node_t node = (EXP2(nb_depth) + leaf) >> order;
 
-        nb_alloc_again:;
-        uint32_t ts = nb_release_count;
-        uint32_t level = LOG2_LOWER(nb_total_memory / size);
+                __nb_freenode(node, nb_base_level);
+                FAD_RELAXED(&nb_header->release_count, 1);
+                FAD_RELAXED(&nb_header->reserved_bytes,
+                        -(EXP2(order) * NB_MIN_SIZE));
+                __nb_notify(node);
 
-        if (nb_depth < level) {
-                level = nb_depth;
+                leaf += EXP2(order);
         }
+}
 
-        /* Range of nodes at target level */
-        uint32_t start_node = EXP2(level);
-        uint32_t end_node = EXP2(level + 1);
-
-        for (uint32_t i = start_node; i < end_node; i++) {
-                if (nb_is_free(nb_tree[i])) {
-                        uint32_t failed_at = __nb_try_alloc(i);
-
-                        if (!failed_at) {
-                                /* TODO: Explain what's going on here */
-                                uint32_t leaf = __nb_leftmost(
-                                        i, nb_depth) - EXP2(nb_depth);
-                                nb_index[leaf] = i;
-
-                                FAD(&nb_stat_alloc_blocks[nb_depth - level], 1);
-                                
-                                return (void*)
-                                        (nb_base_address + leaf * NB_MIN_SIZE);
-                        } else {
-                                /* Skip the entire subtree [of failed] */
-                                uint32_t curr_level = nb_level(i);
-                                uint32_t fail_level = nb_level(failed_at);
-
-                                uint32_t d = EXP2(curr_level - fail_level);
-                                i = ((failed_at + 1) * d) - 1;
-                        }
+/* Occupies the pages [start, end); a handful of nodes, not page by page */
+static int __nb_reserve(uint64_t start, uint64_t end)
+{
+        for (uint64_t leaf = start; leaf < end; ) {
+                uint32_t order = __nb_range_order(leaf, end);
+                nb_node_t node = (EXP2(nb_depth) + leaf) >> order;
+
+                /* Partially in use; undo */
+                if (__nb_try_alloc(node)) {
+                        __nb_unreserve(start, leaf);
+                        return 1;
                 }
-        }
 
-        /* A release occured, try again */
-        if (ts != nb_release_count) {
-                goto nb_alloc_again;
+                nb_index[leaf] = node | NB_INDEX_RESERVED;
+                FAD_RELAXED(&nb_header->reserved_bytes,
+                        EXP2(order) * NB_MIN_SIZE);
+
+                leaf += EXP2(order);
         }
 
-        return (void*) 0;
+        return 0;
 }
 
-void __nb_unmark(uint32_t node, uint32_t upper_bound)
+int nb_reserve_range(uint64_t addr, uint64_t size)
 {
-        uint32_t current = node;
-        uint32_t child = 0;
+        uint64_t span = EXP2(nb_depth) * NB_MIN_SIZE;
 
-        uint8_t curr_val = 0;
-        uint8_t new_val = 0;
-
-        do {
-                child = current;
-                current = current >> 1;
+        if (!size || addr < nb_base_address ||
+                        nb_base_address + span - addr < size) {
+                return 1;
+        }
 
-                do {
-                        curr_val = nb_tree[current];
+        /* Every page it touches */
+        uint64_t start = (addr - nb_base_address) / NB_MIN_SIZE;
+        uint64_t end = __nb_align(addr - nb_base_address + size,
+                NB_MIN_SIZE) / NB_MIN_SIZE;
 
-                        if (!nb_is_coal(curr_val, child)) {
-                                return;
-                        }
-                        
-                        new_val = nb_unmark(curr_val, child);
-                } while (!BCAS(&nb_tree[current], &curr_val, new_val));
-        } while (upper_bound < nb_level(current) &&
-                        !nb_is_occ_buddy(new_val, child));
+        return __nb_reserve(start, end);
 }
 
-void __nb_freenode(uint32_t node, uint32_t upper_bound)
+int nb_init_map(const struct nb_region *regions, uint32_t n)
 {
-        /* TODO: should I check for double frees? */
-        if (nb_is_free(nb_tree[node])) {
-                return;
+        if (!regions || !n) {
+                return 1;
         }
 
-        /* Phase 1. Ancestors of the node are marked as coalescing */
-        uint32_t current = node >> 1;
-        uint32_t child = node;
-
-        while (nb_base_level < nb_level(child)) {
-                uint8_t curr_val = 0;
-                uint8_t new_val = 0;
-                uint8_t old_val = 0;
-                
-                do {
-                        curr_val = nb_tree[current];
-                        new_val = nb_set_coal(curr_val, child);
-                        old_val = VCAS(&nb_tree[current], &curr_val, new_val);
-                } while (old_val != curr_val);
-                
-                if (nb_is_occ_buddy(old_val, child) && 
-                        nb_is_coal_buddy(old_val, child)) {
-                        break;
+        /* Sorted & disjoint */
+        for (uint32_t i = 1; i < n; i++) {
+                if (regions[i].base < regions[i - 1].base +
+                                regions[i - 1].size) {
+                        return 1;
                 }
-
-                child = current;
-                current = current >> 1;
         }
 
-        /* Phase 2. Mark the node as free */
-        nb_tree[node] = 0;
+        uint64_t base = regions[0].base;
+        uint64_t pages = (regions[n - 1].base + regions[n - 1].size - base) /
+                NB_MIN_SIZE;
+        if (!pages) {
+                return 1;
+        }
 
-        /* Phase 3. Propagate node release upward and possibly merge buddies */
-        if (nb_level(node) != nb_base_level) {
-                __nb_unmark(node, upper_bound);
+        /* The tree covers a power of two; the tail is a hole as well */
+        uint64_t span = EXP2(LOG2_LOWER(pages));
+        if (span < pages) {
+                span <<= 1;
         }
-}
 
-void nb_free(void *addr)
-{
-        if (!addr) {
-                return;
+        if (nb_init(base, span * NB_MIN_SIZE)) {
+                return 1;
         }
 
-        uint32_t n = ((uint64_t) addr - nb_base_address) / NB_MIN_SIZE;
-        __nb_freenode(nb_index[n], nb_base_level);
+        /* Pages partially in a region are left out */
+        uint64_t hole = 0;
+        for (uint32_t i = 0; i < n; i++) {
+                if (!regions[i].size) {
+                        continue;
+                }
 
-        FAD(&nb_release_count, 1);
-        FAD(&nb_stat_alloc_blocks[nb_depth - nb_level(nb_index[n])], -1);
-}
+                uint64_t first = __nb_align(regions[i].base - base,
+                        NB_MIN_SIZE) / NB_MIN_SIZE;
+                uint64_t last = (regions[i].base + regions[i].size - base) /
+                        NB_MIN_SIZE;
 
-/* ------------------------------ STATISTICS -------------------------------- */
+                if (hole < first && __nb_reserve(hole, first)) {
+                        return 1;
+                }
 
-uint64_t nb_stat_min_size()
-{
-        return NB_MIN_SIZE;
+                if (hole < last) {
+                        hole = last;
+                }
+        }
+
+        return hole < span ? __nb_reserve(hole, span) : 0;
 }
 
-uint32_t nb_stat_max_order()
+void nb_set_release(uint32_t order, uint64_t interval)
 {
-        return NB_MAX_ORDER;
+        nb_release_order = order;
+        nb_release_interval = interval;
 }
 
-uint64_t nb_stat_tree_size()
+void nb_set_combining(uint32_t mode)
 {
-        return nb_tree_size;
+        nb_combine_mode = mode;
+        __atomic_store_n(&nb_combining, mode == NB_COMBINE_ON,
+                __ATOMIC_RELAXED);
 }
 
-uint64_t nb_stat_index_size()
+void nb_set_policy(uint32_t policy)
 {
-        return nb_index_size;
+        nb_policy = policy;
 }
 
-uint32_t nb_stat_depth()
+int nb_hugepage_advise()
 {
-        return nb_depth;
+#ifdef MADV_HUGEPAGE
+        uint64_t size = EXP2(nb_depth) * NB_MIN_SIZE;
+
+        return madvise((void*) nb_base_address, size, MADV_HUGEPAGE) ? 1 : 0;
+#else
+        return 1;
+#endif
 }
 
-uint32_t nb_stat_base_level()
+static void __nb_attach(uint8_t *segment)
 {
-        return nb_base_level;
+        struct nb_header *header = (struct nb_header*) segment;
+
+        __nb_setup((uint64_t) segment + header->arena_offset, header->size);
+
+        nb_tree = segment + header->tree_offset;
+        nb_index = (nb_node_t*) (segment + header->index_offset);
+        nb_dirty = (uint64_t*) (segment + header->dirty_offset);
+        nb_header = header;
+        nb_owner = __nb_owner_map();
+        nb_mobility = __nb_mobility_map();
+#if NB_TAGS
+        nb_tag = __nb_tag_map();
+#endif
 }
 
-uint64_t nb_stat_max_size()
+static uint64_t __nb_checksum(struct nb_header *header)
 {
-        return nb_max_size;
+        /* FNV-1a */
+        uint8_t *bytes = (uint8_t*) header;
+        uint64_t hash = 0xcbf29ce484222325ULL;
+
+        for (uint64_t i = 0; i < offsetof(struct nb_header, checksum); i++) {
+                hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+
+        return hash;
 }
 
-uint32_t nb_stat_release_count()
+/* Layout: header | tree | index | dirty | arena */
+static uint8_t* __nb_format(int fd, uint64_t size)
 {
-        return nb_release_count;
-}
+        /* The current arena stays untouched until the segment is mapped */
+        uint64_t tree_size, index_size, dirty_size;
+        __nb_sizes(size, &tree_size, &index_size, &dirty_size);
+
+        uint64_t tree_offset = __nb_align(sizeof(struct nb_header), 64);
+        uint64_t index_offset = __nb_align(tree_offset + tree_size, 64);
+        uint64_t dirty_offset = __nb_align(index_offset + index_size, 64);
+        uint64_t arena_offset = __nb_align(dirty_offset + dirty_size,
+                NB_MIN_SIZE);
+        uint64_t segment_size = arena_offset + size;
+
+        if (ftruncate(fd, segment_size)) {
+                return 0;
+        }
+
+        uint8_t *segment = (uint8_t*) mmap(0, segment_size,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (segment == MAP_FAILED) {
+                /* Formatted again by the next open */
+                int ret = ftruncate(fd, 0);
+                (void) ret;
+                return 0;
+        }
 
+        /* A fresh segment is already zero filled */
+        struct nb_header *header = (struct nb_header*) segment;
+        header->version = NB_SEGMENT_VERSION;
+        header->max_order = NB_MAX_ORDER;
+        header->min_size = NB_MIN_SIZE;
+        header->size = size;
+        header->tree_offset = tree_offset;
+        header->index_offset = index_offset;
+        header->dirty_offset = dirty_offset;
+        header->arena_offset = arena_offset;
+        header->segment_size = segment_size;
+        header->node_size = sizeof(nb_node_t);
+
+        __nb_attach(segment);
+
+        struct nb_header published = *header;
+        published.magic = NB_SEGMENT_MAGIC;
+        header->checksum = __nb_checksum(&published);
+
+        /* Publish; attachers check the magic first */
+        __atomic_store_n(&header->magic, NB_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+
+        return segment;
+}
 
-uint64_t nb_stat_total_memory()
+static uint8_t* __nb_map(int fd)
 {
-        return nb_total_memory;
+        struct stat st;
+        if (fstat(fd, &st) ||
+                (uint64_t) st.st_size < sizeof(struct nb_header)) {
+                return 0;
+        }
+
+        uint8_t *segment = (uint8_t*) mmap(0, st.st_size,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (segment == MAP_FAILED) {
+                return 0;
+        }
+
+        /* Must be created by a compatible build */
+        struct nb_header *header = (struct nb_header*) segment;
+        if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) !=
+                        NB_SEGMENT_MAGIC ||
+                header->checksum != __nb_checksum(header) ||
+                header->version != NB_SEGMENT_VERSION ||
+                header->max_order != NB_MAX_ORDER ||
+                header->min_size != NB_MIN_SIZE ||
+                header->node_size != sizeof(nb_node_t) ||
+                header->segment_size != (uint64_t) st.st_size) {
+                munmap(segment, st.st_size);
+                return 0;
+        }
+
+        __nb_attach(segment);
+
+        return segment;
 }
 
-uint64_t nb_stat_used_memory()
+int nb_init_shared(const char *name, uint64_t size)
 {
-        uint64_t used_memory = 0;
+        if (!__nb_fits(size)) {
+                return 1;
+        }
 
-        for (uint32_t i = 0; i <= NB_MAX_ORDER; i++) {
-                used_memory += nb_stat_alloc_blocks[i] * nb_stat_block_size(i);
+        int fd = -1;
+
+        if (name) {
+                fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        } else {
+#ifdef __linux__
+                fd = memfd_create("nbbs", 0);
+#endif
         }
 
-        return used_memory;
+        if (fd < 0) {
+                return 1;
+        }
+
+        uint8_t *segment = __nb_format(fd, size);
+        close(fd);
+
+        /* Don't leave a half made object behind */
+        if (!segment && name) {
+                shm_unlink(name);
+        }
+
+        return segment ? 0 : 1;
+}
+
+int nb_attach_shared(const char *name)
+{
+        if (!name) {
+                return 1;
+        }
+
+        int fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) {
+                return 1;
+        }
+
+        uint8_t *segment = __nb_map(fd);
+        close(fd);
+
+        return segment ? 0 : 1;
+}
+
+/* Reserved or offline block at the leaf, not one of a caller */
+static inline uint8_t __nb_is_reserved(nb_node_t node, uint64_t leaf)
+{
+        nb_node_t entry = nb_index[leaf];
+
+        return (entry & NB_INDEX_RESERVED) &&
+                (entry | NB_INDEX_OFFLINE) == (node | NB_INDEX_OFFLINE);
+}
+
+/* Rebuilds the status bits of a subtree from its allocated blocks */
+static uint8_t __nb_recover(nb_node_t node, uint8_t covered)
+{
+        uint8_t occupied = !covered && (nb_tree[node] & OCC);
+        uint8_t val = occupied ? BUSY : 0;
+
+        if (nb_level(node) < nb_depth) {
+                covered = covered || occupied;
+
+                if (__nb_recover(node << 1, covered) && !occupied) {
+                        val |= OCC_LEFT;
+                }
+
+                if (__nb_recover((node << 1) + 1, covered) && !occupied) {
+                        val |= OCC_RIGHT;
+                }
+        }
+
+        if (occupied) {
+                uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+
+                if (__nb_is_reserved(node, leaf)) {
+                        nb_header->reserved_bytes += EXP2(nb_depth -
+                                nb_level(node)) * NB_MIN_SIZE;
+                } else {
+                        nb_header->alloc_blocks[nb_depth - nb_level(node)]++;
+                }
+        }
+
+        nb_tree[node] = val;
+
+        return val;
+}
+
+int nb_open_file(const char *path, uint64_t size)
+{
+        if (!path) {
+                return 1;
+        }
+
+        int fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+                return 1;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st)) {
+                close(fd);
+                return 1;
+        }
+
+        /* New file */
+        if (st.st_size == 0) {
+                uint8_t *segment = !__nb_fits(size) ? 0 :
+                        __nb_format(fd, size);
+                close(fd);
+
+                return segment ? 0 : 1;
+        }
+
+        uint8_t *segment = __nb_map(fd);
+        close(fd);
+
+        if (!segment) {
+                return 1;
+        }
+
+        /*
+         * Not closed properly; an alloc or free might've been interrupted
+         * half way through. Rebuild the tree from the allocated blocks, which
+         * drops transient coalescing bits & stale occupancy marks.
+         */
+        if (!nb_header->clean) {
+                memset((void*) nb_header->alloc_blocks, 0x0,
+                        sizeof(nb_header->alloc_blocks));
+                nb_header->reserved_bytes = 0;
+                memset((void*) nb_header->first_free, 0x0,
+                        sizeof(nb_header->first_free));
+                memset((void*) nb_tree, 0x0, EXP2(nb_base_level));
+
+                for (nb_node_t i = EXP2(nb_base_level);
+                                i < EXP2(nb_base_level + 1); i++) {
+                        __nb_recover(i, 0);
+                }
+        }
+
+        nb_header->clean = 0;
+        msync((void*) nb_header, sizeof(struct nb_header), MS_SYNC);
+
+        return 0;
+}
+
+int nb_close_file()
+{
+        if (nb_header == &nb_local_header) {
+                return 1;
+        }
+
+        uint8_t *segment = (uint8_t*) nb_header;
+        uint64_t segment_size = nb_header->segment_size;
+
+        if (msync(segment, segment_size, MS_SYNC)) {
+                return 1;
+        }
+
+        /* Everything else is on disk; only then mark it clean */
+        nb_header->clean = 1;
+        msync(segment, sizeof(struct nb_header), MS_SYNC);
+
+        munmap(segment, segment_size);
+
+        nb_tree = 0;
+        nb_index = 0;
+        nb_header = &nb_local_header;
+        memset((void*) nb_header, 0x0, sizeof(struct nb_header));
+
+        return 0;
+}
+
+uint64_t nb_alloc_offset(uint64_t size)
+{
+        void *addr = nb_alloc(size);
+
+        return addr ? nb_addr_to_offset(addr) : NB_INVALID_OFFSET;
+}
+
+void nb_free_offset(uint64_t offset)
+{
+        if (offset == NB_INVALID_OFFSET) {
+                return;
+        }
+
+        nb_free(nb_offset_to_addr(offset));
+}
+
+void* nb_offset_to_addr(uint64_t offset)
+{
+        return (void*) (nb_base_address + offset);
+}
+
+uint64_t nb_addr_to_offset(void *addr)
+{
+        return (uint64_t) addr - nb_base_address;
+}
+
+static uint64_t __nb_now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t __nb_commit(nb_node_t node)
+{
+        /* Base level block that contains the node */
+        nb_node_t base = node >> (nb_level(node) - nb_base_level);
+        nb_node_t slot = base - EXP2(nb_base_level);
+
+        if (__atomic_load_n(&nb_commit_map[slot], __ATOMIC_ACQUIRE)) {
+                return 0;
+        }
+
+        /* Racing threads may both commit; mprotect is idempotent */
+        uint64_t addr = nb_base_address + slot * nb_max_size;
+        if (mprotect((void*) addr, nb_max_size, PROT_READ | PROT_WRITE)) {
+                return 1;
+        }
+
+        uint8_t committed = 0;
+        if (BCAS(&nb_commit_map[slot], &committed, 1)) {
+                FAD_RELAXED(&nb_stat_committed, nb_max_size);
+        }
+
+        return 0;
+}
+
+/* Takes back the access of an owned, released base level block */
+static void __nb_decommit(nb_node_t base)
+{
+        nb_node_t slot = base - EXP2(nb_base_level);
+        uint64_t addr = nb_base_address + slot * nb_max_size;
+
+        if (mprotect((void*) addr, nb_max_size, PROT_NONE)) {
+                return;
+        }
+
+        uint8_t committed = 1;
+        if (BCAS(&nb_commit_map[slot], &committed, 0)) {
+                FAD_RELAXED(&nb_stat_committed, -nb_max_size);
+        }
+}
+
+static void __nb_mark_pages(uint64_t leaf, uint64_t pages, uint8_t dirty)
+{
+        for (uint64_t p = leaf; p < leaf + pages; ) {
+                uint64_t bit = p % 64;
+                uint64_t count = leaf + pages - p < 64 - bit ?
+                        leaf + pages - p : 64 - bit;
+                uint64_t mask = (count == 64 ? ~0ULL :
+                        (EXP2(count) - 1)) << bit;
+
+                if (dirty) {
+                        __atomic_fetch_or(&nb_dirty[p / 64], mask,
+                                __ATOMIC_RELEASE);
+                } else {
+                        __atomic_fetch_and(&nb_dirty[p / 64], ~mask,
+                                __ATOMIC_RELEASE);
+                }
+
+                p += count;
+        }
+}
+
+static uint8_t __nb_any_dirty(uint64_t leaf, uint64_t pages)
+{
+        for (uint64_t p = leaf; p < leaf + pages; p += 64 - p % 64) {
+                if (nb_dirty[p / 64]) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+/* Zeroes the dirty pages of an owned block; returns the pages cleaned */
+static uint64_t __nb_zero_pages(uint64_t leaf, uint64_t pages)
+{
+        uint64_t cleaned = 0;
+        uint64_t run = 0; /* dirty pages right before 'p + i' */
+
+        for (uint64_t p = leaf; p < leaf + pages; ) {
+                uint64_t bit = p % 64;
+                uint64_t count = leaf + pages - p < 64 - bit ?
+                        leaf + pages - p : 64 - bit;
+                uint64_t mask = (count == 64 ? ~0ULL :
+                        (EXP2(count) - 1)) << bit;
+
+                uint64_t dirty = __atomic_fetch_and(&nb_dirty[p / 64], ~mask,
+                        __ATOMIC_ACQ_REL) & mask;
+
+                for (uint64_t i = 0; i < count; i++) {
+                        if (dirty & EXP2(bit + i)) {
+                                run++;
+                                continue;
+                        }
+
+                        if (run) {
+                                __nb_clean_block((void*) (nb_base_address +
+                                        (p + i - run) * NB_MIN_SIZE),
+                                        run * NB_MIN_SIZE);
+                                cleaned += run;
+                                run = 0;
+                        }
+                }
+
+                p += count;
+        }
+
+        if (run) {
+                __nb_clean_block((void*) (nb_base_address +
+                        (leaf + pages - run) * NB_MIN_SIZE),
+                        run * NB_MIN_SIZE);
+                cleaned += run;
+        }
+
+        return cleaned;
+}
+
+/* Gives the pages of a free block back to the OS */
+static void __nb_release_block(nb_node_t top)
+{
+        /* Own the block so no one can allocate it while it's being released */
+        if (__nb_try_alloc(top)) {
+                return;
+        }
+
+        uint32_t level = nb_level(top);
+        uint64_t size = EXP2(nb_depth - level) * NB_MIN_SIZE;
+        uint64_t leaf = __nb_leftmost(top, nb_depth) - EXP2(nb_depth);
+
+#if NB_RELEASE_LAZY
+        madvise((void*) (nb_base_address + leaf * NB_MIN_SIZE), size,
+                MADV_FREE);
+#else
+        /* Faulted back in as zero pages */
+        if (!madvise((void*) (nb_base_address + leaf * NB_MIN_SIZE), size,
+                        MADV_DONTNEED)) {
+                __nb_mark_pages(leaf, size / NB_MIN_SIZE, 0);
+
+                /* Committed again by the next allocation inside */
+                if (level == nb_base_level) {
+                        __nb_decommit(top);
+                }
+        }
+#endif
+        FAD_RELAXED(&nb_stat_released, size);
+
+        __nb_freenode(top, nb_base_level);
+        FAD_RELAXED(&nb_header->release_count, 1);
+
+        __nb_notify(top);
+}
+
+/* Rate limit; only one thread wins the slot */
+static uint8_t __nb_release_slot()
+{
+        uint64_t now = __nb_now();
+        uint64_t last = nb_release_last;
+        if (now - last < nb_release_interval) {
+                return 0;
+        }
+
+        return BCAS(&nb_release_last, &last, now);
+}
+
+static uint8_t __nb_release_queued()
+{
+        for (uint32_t i = 0; i < NB_RELEASE_PENDING; i++) {
+                if (__atomic_load_n(&nb_release_pending[i], __ATOMIC_RELAXED)) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+/* Releases the blocks that lost the slot; they may have been taken since */
+static void __nb_release_pending()
+{
+        for (uint32_t i = 0; i < NB_RELEASE_PENDING; i++) {
+                if (!__atomic_load_n(&nb_release_pending[i],
+                                __ATOMIC_RELAXED)) {
+                        continue;
+                }
+
+                nb_node_t node = __atomic_exchange_n(&nb_release_pending[i], 0,
+                        __ATOMIC_ACQ_REL);
+                nb_node_t top = node ? __nb_free_top(node) : 0;
+
+                if (top && nb_release_order <= nb_depth - nb_level(top)) {
+                        __nb_release_block(top);
+                }
+        }
+}
+
+static void __nb_release(nb_node_t node)
+{
+        nb_node_t top = __nb_free_top(node);
+        if (!top || nb_depth - nb_level(top) < nb_release_order) {
+                return;
+        }
+
+        if (__nb_release_slot()) {
+                __nb_release_block(top);
+                __nb_release_pending();
+                return;
+        }
+
+        /* Retried by the next release or nb_reclaim; dropped if full */
+        for (uint32_t i = 0; i < NB_RELEASE_PENDING; i++) {
+                nb_node_t pending = __atomic_load_n(&nb_release_pending[i],
+                        __ATOMIC_RELAXED);
+
+                if (pending == top) {
+                        return;
+                }
+
+                if (!pending && BCAS(&nb_release_pending[i], &pending, top)) {
+                        return;
+                }
+        }
+}
+
+static void __nb_thread_exit(void *record)
+{
+        __atomic_store_n(&((struct nb_thread*) record)->active, 0,
+                __ATOMIC_RELEASE);
+        FAD_RELAXED(&nb_thread_epoch, 1);
+}
+
+static void __nb_thread_key()
+{
+        pthread_key_create(&nb_thread_key, __nb_thread_exit);
+}
+
+/* Record of the calling thread; 0 only if out of memory */
+static struct nb_thread* __nb_self()
+{
+        if (nb_self) {
+                return nb_self;
+        }
+
+        pthread_once(&nb_thread_once, __nb_thread_key);
+
+        /* Reuse the record of an exited thread */
+        struct nb_thread *record = __atomic_load_n(&nb_threads,
+                __ATOMIC_ACQUIRE);
+        for (; record; record = record->next) {
+                uint32_t inactive = 0;
+                if (!record->active && __atomic_compare_exchange_n(
+                                &record->active, &inactive, 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                        break;
+                }
+        }
+
+        if (!record) {
+                record = (struct nb_thread*) NB_MALLOC(sizeof(*record));
+                if (!record) {
+                        return 0;
+                }
+
+                memset((void*) record, 0x0, sizeof(*record));
+                record->active = 1;
+                record->seed = (uint64_t) record | 1;
+                record->id = FAD_RELAXED(&nb_thread_count, 1) - 1;
+
+                record->next = __atomic_load_n(&nb_threads, __ATOMIC_RELAXED);
+                while (!BCAS(&nb_threads, &record->next, record));
+        }
+
+        pthread_setspecific(nb_thread_key, record);
+        nb_self = record;
+
+        FAD_RELAXED(&nb_thread_epoch, 1);
+
+        return record;
+}
+
+static inline uint64_t __nb_random(struct nb_thread *self)
+{
+        self->seed ^= self->seed << 13;
+        self->seed ^= self->seed >> 7;
+        self->seed ^= self->seed << 17;
+
+        return self->seed;
+}
+
+static inline void __nb_pause()
+{
+#if __x86_64__
+        _mm_pause();
+#elif __aarch64__
+        __asm__ volatile("yield");
+#endif
+}
+
+/*
+ * A CAS at the site lost a race; back off before retrying. The window
+ * doubles on every failure & halves on every new attempt, so it follows
+ * the contention observed by the thread. Past NB_BACKOFF_MAX it yields.
+ */
+uint8_t __nb_contended(uint32_t site)
+{
+        struct nb_thread *self = __nb_self();
+        if (!self) {
+                return 1;
+        }
+
+        FAD_RELAXED(&self->cas_failures[site], 1);
+        NB_PROBE1(cas_fail, site);
+
+        if (self->backoff < NB_BACKOFF_MAX) {
+                self->backoff = self->backoff ? self->backoff << 1 :
+                        NB_BACKOFF_MIN;
+        } else {
+                sched_yield();
+                return 1;
+        }
+
+        /* Jitter; threads that collided don't retry in lockstep */
+        for (uint64_t i = __nb_random(self) % self->backoff; i; i--) {
+                __nb_pause();
+        }
+
+        return 1;
+}
+
+inline void __nb_uncontended()
+{
+        if (nb_self && nb_self->backoff) {
+                nb_self->backoff >>= 1;
+        }
+}
+
+/* Backoff window of the calling thread; pauses */
+uint32_t __nb_backoff()
+{
+        return nb_self ? nb_self->backoff : 0;
+}
+
+#if NB_INSTRUMENT || NB_TRACE
+static inline uint64_t __nb_ticks()
+{
+#if __x86_64__
+        return __rdtsc();
+#elif __aarch64__
+        uint64_t ticks = 0;
+        __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return __nb_now();
+#endif
+}
+#endif
+
+#if NB_INSTRUMENT
+static inline void __nb_hist(struct nb_thread *self, uint32_t hist,
+        uint64_t val)
+{
+        uint32_t bucket = val ? LOG2_LOWER(val) + 1 : 0;
+        if (NB_HIST_BUCKETS <= bucket) {
+                bucket = NB_HIST_BUCKETS - 1;
+        }
+
+        /* Single writer; readers only need untorn values */
+        uint64_t *count = &self->hist[hist][bucket];
+        __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t __nb_op_begin()
+{
+        struct nb_thread *self = __nb_self();
+        if (self) {
+                self->op_scanned = 0;
+                self->op_failures = 0;
+                self->op_restarts = 0;
+                self->op_climbed = 0;
+        }
+
+        return __nb_ticks();
+}
+
+/* Operations applied by a combiner are counted in the requester's record */
+static void __nb_op_end(uint32_t hist, uint64_t start)
+{
+        uint64_t ticks = __nb_ticks() - start;
+
+        struct nb_thread *self = nb_self;
+        if (!self) {
+                return;
+        }
+
+        __nb_hist(self, hist, ticks);
+        __nb_hist(self, NB_HIST_CLIMBED, self->op_climbed);
+
+        if (hist == NB_HIST_ALLOC_TICKS) {
+                __nb_hist(self, NB_HIST_SCANNED, self->op_scanned);
+                __nb_hist(self, NB_HIST_FAILURES, self->op_failures);
+                __nb_hist(self, NB_HIST_RESTARTS, self->op_restarts);
+        }
+}
+#else
+static inline uint64_t __nb_op_begin()
+{
+        return 0;
+}
+
+static inline void __nb_op_end(uint32_t hist, uint64_t start)
+{
+        (void) hist;
+        (void) start;
+}
+#endif
+
+nb_node_t __nb_try_alloc(nb_node_t node)
+{
+        __nb_uncontended();
+
+        /* Occupy the node */
+        uint8_t free = 0;
+        if (!BCAS(&nb_tree[node], &free, BUSY)) {
+                /* Taken in the meantime; no point in retrying */
+                if (__nb_self()) {
+                        FAD_RELAXED(&nb_self->cas_failures[NB_SITE_OCCUPY], 1);
+                }
+                NB_PROBE1(cas_fail, NB_SITE_OCCUPY);
+                NB_COUNT(op_failures, 1);
+
+                return node;
+        }
+
+        nb_node_t current = node;
+        nb_node_t child = 0;
+
+        /* Propagate the info about the occupancy up to the ancestor node(s) */
+        while (nb_base_level < nb_level(current)) {
+                child = current;
+                current = current >> 1;
+                NB_COUNT(op_climbed, 1);
+
+                uint8_t curr_val = 0;
+                uint8_t new_val = 0;
+
+                do {
+                        curr_val = nb_tree[current];
+
+                        if (curr_val & OCC) {
+                                __nb_freenode(node, nb_level(child));
+                                __nb_notify(node);
+                                NB_COUNT(op_failures, 1);
+                                return current;
+                        }
+
+                        new_val = nb_clean_coal(curr_val, child);
+                        new_val = nb_mark(new_val, child);
+                } while (!BCAS(&nb_tree[current], &curr_val, new_val) &&
+                        __nb_contended(NB_SITE_MARK));
+        }
+
+        return 0;
+}
+
+/* TODO: Ugly code; refactor */
+nb_node_t __nb_leftmost(nb_node_t node, uint32_t depth)
+{
+        /* Index to level */
+        uint32_t level = nb_level(node);
+
+        /* Size (in terms of leaf size) */
+        uint64_t block_size = EXP2(depth - level);
+
+        /* Offset within level */
+        uint64_t offset = node % EXP2(level);
+
+        /* Leftmost leaf */
+        nb_node_t leftmost_leaf = EXP2(depth) + offset * block_size;
+
+        return leftmost_leaf;
+}
+
+void __nb_clean_block(void* addr, uint64_t size)
+{
+        if (!addr || !size) {
+                return;
+        }
+
+#if __x86_64__
+        /* Large blocks would only evict useful lines; bypass the caches */
+        if (NB_NT_THRESHOLD <= size && !((uint64_t) addr % 16) &&
+                        !(size % 64)) {
+                __m128i zero = _mm_setzero_si128();
+
+                for (uint8_t *p = addr; p < (uint8_t*) addr + size; p += 64) {
+                        _mm_stream_si128((__m128i*) (p + 0), zero);
+                        _mm_stream_si128((__m128i*) (p + 16), zero);
+                        _mm_stream_si128((__m128i*) (p + 32), zero);
+                        _mm_stream_si128((__m128i*) (p + 48), zero);
+                }
+                _mm_sfence();
+
+                return;
+        }
+#endif
+
+        memset(addr, 0x0, size);
+}
+
+/*
+ * Lowest occupied ancestor of the node, if any, read with plain loads. The
+ * nodes under an allocated block look free; this skips them without taking
+ * the node, marking its ancestors & rolling all of it back again. Only a
+ * hint: __nb_try_alloc still has the final word on what it returns 0 for.
+ */
+static inline nb_node_t __nb_occupied_above(nb_node_t node)
+{
+        for (nb_node_t current = node >> 1;
+                        nb_base_level <= nb_level(current); current >>= 1) {
+                if (__atomic_load_n(&nb_tree[current], __ATOMIC_RELAXED) &
+                                OCC) {
+                        NB_COUNT(op_failures, 1);
+                        return current;
+                }
+        }
+
+        return 0;
+}
+
+#if NB_SCAN_HINT
+/* Leftmost node of the level that may be free; 0 for the level start */
+static inline nb_node_t __nb_hint_first(uint32_t level)
+{
+        if (nb_scan_unhinted || NB_MAX_ORDER < nb_depth - level) {
+                return 0;
+        }
+
+        return __atomic_load_n(&nb_header->first_free[nb_depth - level],
+                __ATOMIC_RELAXED);
+}
+
+/*
+ * Narrows a scan to the nodes the hint leaves open. Returns the hint if the
+ * scan may move it, i.e. it starts at or left of it. Without the hint (see
+ * __nb_alloc), only the nodes left of it are scanned; the others already
+ * were.
+ */
+static inline nb_node_t* __nb_hint_range(nb_node_t *start, nb_node_t *end,
+        nb_node_t *seen)
+{
+        uint32_t level = nb_level(*start);
+        if (NB_MAX_ORDER < nb_depth - level) {
+                return 0;
+        }
+
+        nb_node_t *hint = &nb_header->first_free[nb_depth - level];
+        *seen = __atomic_load_n(hint, __ATOMIC_RELAXED);
+
+        if (nb_scan_unhinted) {
+                if (*seen && *seen < *end) {
+                        *end = *seen;
+                }
+                return 0;
+        }
+
+        if (*start > (*seen ? *seen : EXP2(level))) {
+                return 0;
+        }
+
+        if (*start < *seen) {
+                *start = *seen;
+        }
+
+        return hint;
+}
+
+/* Past the nodes a scan found taken, unless a release lowered it meanwhile */
+static inline void __nb_hint_raise(nb_node_t *hint, nb_node_t seen,
+        nb_node_t next)
+{
+        /* Read first; a CAS takes the line even if it fails */
+        if (seen < next && __atomic_load_n(hint, __ATOMIC_RELAXED) == seen) {
+                BCAS(hint, &seen, next);
+        }
+}
+
+/* The released block & its nodes on every level below may be taken again */
+static void __nb_hint_lower(nb_node_t node)
+{
+        nb_node_t top = __nb_free_top(node);
+        if (!top) {
+                return;
+        }
+
+        uint32_t level = nb_level(top);
+
+        for (uint32_t l = level; l <= nb_depth; l++) {
+                nb_node_t *hint = &nb_header->first_free[nb_depth - l];
+                nb_node_t first = top << (l - level);
+                nb_node_t curr = __atomic_load_n(hint, __ATOMIC_RELAXED);
+
+                while (first < curr && !BCAS(hint, &curr, first));
+        }
+}
+#else
+static inline nb_node_t __nb_hint_first(uint32_t level)
+{
+        (void) level;
+        return 0;
+}
+
+static inline nb_node_t* __nb_hint_range(nb_node_t *start, nb_node_t *end,
+        nb_node_t *seen)
+{
+        (void) start;
+        (void) end;
+        (void) seen;
+        return 0;
+}
+
+static inline void __nb_hint_raise(nb_node_t *hint, nb_node_t seen,
+        nb_node_t next)
+{
+        (void) hint;
+        (void) seen;
+        (void) next;
+}
+
+static inline void __nb_hint_lower(nb_node_t node)
+{
+        (void) node;
+}
+#endif
+
+/*
+ * Nodes of the level left of its hint can't be taken (see NB_SCAN_HINT);
+ * scans start from it.
+ */
+nb_node_t __nb_scan(nb_node_t start, nb_node_t end)
+{
+        if (end <= start) {
+                return 0;
+        }
+
+        nb_node_t seen = 0;
+        nb_node_t *hint = __nb_hint_range(&start, &end, &seen);
+
+        for (nb_node_t i = start; i < end; i++) {
+                NB_COUNT(op_scanned, 1);
+
+                if (nb_is_free(nb_tree[i])) {
+                        nb_node_t failed_at = __nb_occupied_above(i);
+                        if (!failed_at) {
+                                failed_at = __nb_try_alloc(i);
+                        }
+
+                        if (!failed_at) {
+                                if (hint) {
+                                        __nb_hint_raise(hint, seen, i + 1);
+                                }
+                                return i;
+                        }
+
+                        /* Skip the entire subtree [of failed] */
+                        uint32_t curr_level = nb_level(i);
+                        uint32_t fail_level = nb_level(failed_at);
+
+                        nb_node_t d = EXP2(curr_level - fail_level);
+                        i = ((failed_at + 1) * d) - 1;
+                }
+        }
+
+        if (hint) {
+                __nb_hint_raise(hint, seen, end);
+        }
+
+        return 0;
+}
+
+/* Scans only the regions (at region_level) that are already split */
+static nb_node_t __nb_scan_split(uint32_t level, uint32_t region_level)
+{
+        uint32_t shift = level - region_level;
+
+        /* Regions left of the hint have no room for the level */
+        nb_node_t r = __nb_hint_first(level) >> shift;
+        if (r < EXP2(region_level)) {
+                r = EXP2(region_level);
+        }
+
+        for (; r < EXP2(region_level + 1); r++) {
+                uint8_t val = nb_tree[r];
+
+                if ((val & OCC) || !(val & (OCC_LEFT | OCC_RIGHT))) {
+                        continue;
+                }
+
+                nb_node_t node = __nb_scan(r << shift, (r + 1) << shift);
+                if (node) {
+                        return node;
+                }
+        }
+
+        return 0;
+}
+
+static nb_node_t __nb_place_huge(uint32_t level)
+{
+        if (level <= nb_huge_level) {
+                return __nb_scan(EXP2(level), EXP2(level + 1));
+        }
+
+        /* First; huge page regions that are already split */
+        nb_node_t node = __nb_scan_split(level, nb_huge_level);
+        if (node) {
+                return node;
+        }
+
+        /* Then; break a whole one */
+        return __nb_scan(EXP2(level), EXP2(level + 1));
+}
+
+/*
+ * Smallest hole of a split subtree that fits the level; a free node whose
+ * buddy is (partially) occupied is a hole of its own size. Only the occupied
+ * paths are walked, never the free space, & none left of the hint (first).
+ */
+static nb_node_t __nb_best_hole(nb_node_t node, uint32_t level,
+        nb_node_t first)
+{
+        uint8_t val = nb_tree[node];
+        if ((val & OCC) || nb_is_free(val) || level <= nb_level(node) ||
+                        ((node + 1) << (level - nb_level(node))) <= first) {
+                return 0;
+        }
+
+        nb_node_t best = 0;
+
+        for (nb_node_t child = node << 1; child <= ((node << 1) | 1);
+                        child++) {
+                nb_node_t hole = nb_is_free(nb_tree[child]) ? child :
+                        __nb_best_hole(child, level, first);
+
+                /* Deeper is smaller; the left one on ties */
+                if (hole && (!best || nb_level(best) < nb_level(hole))) {
+                        best = hole;
+                }
+
+                if (best && nb_level(best) == level) {
+                        break;
+                }
+        }
+
+        return best;
+}
+
+static nb_node_t __nb_place_best(uint32_t level)
+{
+        if (level <= nb_base_level) {
+                return __nb_scan(EXP2(level), EXP2(level + 1));
+        }
+
+        /* Regions left of the hint have no room for the level */
+        uint32_t shift = level - nb_base_level;
+        nb_node_t first = __nb_hint_first(level);
+        nb_node_t start = EXP2(nb_base_level);
+        if (start < (first >> shift)) {
+                start = first >> shift;
+        }
+
+        /* Split max order blocks only, at most NB_BEST_FIT_REGIONS of them */
+        nb_node_t best = 0;
+        uint32_t regions = 0;
+
+        for (nb_node_t i = start; i < EXP2(nb_base_level + 1) &&
+                        regions < NB_BEST_FIT_REGIONS; i++) {
+                uint8_t val = nb_tree[i];
+                if ((val & OCC) || nb_is_free(val)) {
+                        continue;
+                }
+
+                regions++;
+
+                nb_node_t hole = __nb_best_hole(i, level, first);
+                if (hole && (!best || nb_level(best) < nb_level(hole))) {
+                        best = hole;
+                }
+
+                if (best && nb_level(best) == level) {
+                        break;
+                }
+        }
+
+        if (best) {
+                shift = level - nb_level(best);
+                nb_node_t node = __nb_scan(best << shift, (best + 1) << shift);
+                if (node) {
+                        return node;
+                }
+        }
+
+        /* Then (or if the hole was taken meanwhile); first fit */
+        return __nb_scan(EXP2(level), EXP2(level + 1));
+}
+
+/*
+ * Slot of the thread among the active ones, ordered by record id. Only
+ * recounted after a thread came or went; shares are a hint, so a stale
+ * slot only costs a few shared cache lines.
+ */
+static void __nb_repartition(struct nb_thread *self)
+{
+        uint32_t epoch = __atomic_load_n(&nb_thread_epoch, __ATOMIC_RELAXED);
+        if (self->parts && self->epoch == epoch) {
+                return;
+        }
+
+        uint32_t slot = 0;
+        uint32_t parts = 0;
+
+        struct nb_thread *record = __atomic_load_n(&nb_threads,
+                __ATOMIC_ACQUIRE);
+        for (; record; record = record->next) {
+                if (!__atomic_load_n(&record->active, __ATOMIC_RELAXED)) {
+                        continue;
+                }
+
+                slot += record->id < self->id;
+                parts++;
+        }
+
+        self->slot = slot;
+        self->parts = parts ? parts : 1;
+        self->epoch = epoch;
+}
+
+/* Scans the base level blocks of the share */
+static nb_node_t __nb_scan_share(uint32_t level, uint32_t share,
+        uint32_t parts)
+{
+        uint64_t regions = EXP2(nb_base_level);
+        uint32_t shift = level - nb_base_level;
+
+        nb_node_t start = (regions + share * regions / parts) << shift;
+        nb_node_t end = (regions + (share + 1) * regions / parts) << shift;
+
+        return __nb_scan(start, end);
+}
+
+static nb_node_t __nb_place_partition(uint32_t level)
+{
+        struct nb_thread *self = __nb_self();
+        if (!self) {
+                return __nb_scan(EXP2(level), EXP2(level + 1));
+        }
+
+        __nb_repartition(self);
+
+        /* More threads than blocks; neighbours share */
+        uint32_t parts = self->parts;
+        if (EXP2(nb_base_level) < parts) {
+                parts = EXP2(nb_base_level);
+        }
+
+        /* First; own share */
+        uint32_t slot = self->slot % parts;
+        nb_node_t node = __nb_scan_share(level, slot, parts);
+        if (node) {
+                return node;
+        }
+
+        /* Then; steal, starting from a random victim */
+        uint32_t victim = __nb_random(self) % parts;
+        for (uint32_t i = 0; i < parts; i++) {
+                uint32_t share = (victim + i) % parts;
+                if (share == slot) {
+                        continue;
+                }
+
+                node = __nb_scan_share(level, share, parts);
+                if (node) {
+                        return node;
+                }
+        }
+
+        return 0;
+}
+
+static nb_node_t __nb_place(uint32_t level)
+{
+        switch (nb_policy) {
+        case NB_POLICY_HUGE_PACK:
+                return __nb_place_huge(level);
+        case NB_POLICY_BEST_FIT:
+                return __nb_place_best(level);
+        case NB_POLICY_PARTITION:
+                return __nb_place_partition(level);
+        default:
+                return __nb_scan(EXP2(level), EXP2(level + 1));
+        }
+}
+
+static nb_node_t __nb_place_grouped(uint32_t level, uint8_t type)
+{
+        if (level <= nb_base_level || !nb_owner) {
+                return __nb_place(level);
+        }
+
+        uint32_t shift = level - nb_base_level;
+        nb_node_t start = EXP2(nb_base_level);
+
+        /* First; split regions of the same type */
+        for (nb_node_t r = start; r < 2 * start; r++) {
+                uint8_t val = nb_tree[r];
+
+                if (nb_owner[r - start] != type || (val & OCC) ||
+                                !(val & (OCC_LEFT | OCC_RIGHT))) {
+                        continue;
+                }
+
+                nb_node_t node = __nb_scan(r << shift, (r + 1) << shift);
+                if (node) {
+                        return node;
+                }
+        }
+
+        /* Then; claim a whole one */
+        for (nb_node_t r = start; r < 2 * start; r++) {
+                if (!nb_is_free(nb_tree[r])) {
+                        continue;
+                }
+
+                __atomic_store_n(&nb_owner[r - start], type, __ATOMIC_RELAXED);
+
+                nb_node_t node = __nb_scan(r << shift, (r + 1) << shift);
+                if (node) {
+                        return node;
+                }
+        }
+
+        /* Under pressure; steal from the other types */
+        return __nb_place(level);
+}
+
+static void __nb_wmark_notify(uint32_t order, uint32_t event)
+{
+        if (nb_wmark_callback) {
+                nb_wmark_callback(order, event, nb_wmark_ctx);
+        }
+
+#if __linux__
+        if (0 <= nb_wmark_eventfd) {
+                uint64_t one = 1;
+                (void) !write(nb_wmark_eventfd, &one, sizeof(one));
+        }
+#endif
+}
+
+/* Only the thread that flips the bit notifies */
+static void __nb_wmark_low(uint32_t order)
+{
+        uint32_t bit = EXP2(order);
+
+        if (!(nb_wmark_below & bit) &&
+                        !(__atomic_fetch_or(&nb_wmark_below, bit,
+                                __ATOMIC_SEQ_CST) & bit)) {
+                __nb_wmark_notify(order, NB_WMARK_LOW);
+        }
+}
+
+static void __nb_wmark_check()
+{
+        uint64_t free = nb_stat_total_memory() - nb_stat_used_memory();
+
+        for (uint32_t order = 0; order <= NB_MAX_ORDER; order++) {
+                uint32_t bit = EXP2(order);
+
+                if (!(nb_wmark_orders & bit)) {
+                        continue;
+                }
+
+                if (!(nb_wmark_below & bit) && free <= nb_wmark_low[order]) {
+                        __nb_wmark_low(order);
+                } else if ((nb_wmark_below & bit) &&
+                                nb_wmark_high[order] <= free) {
+                        if (__atomic_fetch_and(&nb_wmark_below, ~bit,
+                                        __ATOMIC_SEQ_CST) & bit) {
+                                __nb_wmark_notify(order, NB_WMARK_HIGH);
+                        }
+                }
+        }
+}
+
+int nb_set_watermark(uint32_t order, uint64_t low, uint64_t high)
+{
+        if (NB_MAX_ORDER < order || high < low) {
+                return 1;
+        }
+
+        nb_wmark_low[order] = low;
+        nb_wmark_high[order] = high;
+
+        if (low || high) {
+                __atomic_fetch_or(&nb_wmark_orders, EXP2(order),
+                        __ATOMIC_SEQ_CST);
+        } else {
+                __atomic_fetch_and(&nb_wmark_orders, ~EXP2(order),
+                        __ATOMIC_SEQ_CST);
+                __atomic_fetch_and(&nb_wmark_below, ~EXP2(order),
+                        __ATOMIC_SEQ_CST);
+        }
+
+        return 0;
+}
+
+void nb_set_watermark_callback(
+        void (*callback)(uint32_t order, uint32_t event, void *ctx), void *ctx)
+{
+        nb_wmark_ctx = ctx;
+        nb_wmark_callback = callback;
+}
+
+int nb_watermark_eventfd()
+{
+#if __linux__
+        if (nb_wmark_eventfd < 0) {
+                nb_wmark_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+
+        return nb_wmark_eventfd;
+#else
+        return -1;
+#endif
+}
+
+/*
+ * Blocks of the color; leaves congruent to it modulo NB_COLORS. Those are
+ * evenly strided over the level, so only every stride-th node is tried.
+ */
+static nb_node_t __nb_scan_colored(uint32_t level, uint32_t color)
+{
+        uint64_t pages = EXP2(nb_depth - level);
+        uint64_t stride = NB_COLORS / pages;
+
+        for (nb_node_t i = EXP2(level) + color / pages;
+                        i < EXP2(level + 1); i += stride) {
+                NB_COUNT(op_scanned, 1);
+
+                if (!nb_is_free(nb_tree[i])) {
+                        continue;
+                }
+
+                nb_node_t failed_at = __nb_occupied_above(i);
+                if (!failed_at) {
+                        failed_at = __nb_try_alloc(i);
+                }
+
+                if (!failed_at) {
+                        return i;
+                }
+
+                /* Skip the subtree [of failed]; stay on the stride */
+                nb_node_t d = EXP2(nb_level(i) - nb_level(failed_at));
+                nb_node_t next = (failed_at + 1) * d;
+
+                i += ((next - i - 1) / stride) * stride;
+        }
+
+        return 0;
+}
+
+static void* __nb_alloc(uint64_t size, uint32_t flags, uint32_t color)
+{
+        if (nb_max_size < size) {
+                return 0;
+        }
+
+        if (size < NB_MIN_SIZE) {
+                size = NB_MIN_SIZE;
+        }
+
+        uint32_t level = LOG2_LOWER(nb_total_memory / size);
+
+        if (nb_depth < level) {
+                level = nb_depth;
+        }
+
+        /* Only privileged callers may dip into the reserve */
+        uint32_t order = nb_depth - level;
+        if ((nb_wmark_orders & EXP2(order)) && !(flags & NB_ALLOC_RESERVE) &&
+                nb_stat_total_memory() - nb_stat_used_memory() <
+                        nb_stat_block_size(order) + nb_wmark_low[order]) {
+                /* Refused; as good as below the watermark */
+                __nb_wmark_low(order);
+                return 0;
+        }
+
+#if NB_SCAN_HINT
+        nb_scan_unhinted = 0;
+#endif
+
+        nb_alloc_again:;
+        uint32_t ts = nb_header->release_count;
+        nb_node_t node = 0;
+        if (color != NB_COLOR_ANY && EXP2(nb_depth - level) < NB_COLORS) {
+                node = __nb_scan_colored(level, color);
+        } else if (flags & NB_ALLOC_MOBILITY) {
+                node = __nb_place_grouped(level, flags & NB_ALLOC_MOBILITY);
+        } else {
+                node = __nb_place(level);
+        }
+
+        if (node) {
+                /* No pages behind the block; give it back */
+                if (nb_arena_mmap && __nb_commit(node)) {
+                        __nb_freenode(node, nb_base_level);
+                        FAD_RELAXED(&nb_header->release_count, 1);
+
+                        __nb_notify(node);
+
+                        NB_PROBE2(oom, size, order);
+                        return (void*) 0;
+                }
+
+                /* Blocks are looked up by their first page on release */
+                uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+                nb_index[leaf] = node;
+
+                if (nb_mobility && (flags & NB_ALLOC_MOBILITY)) {
+                        nb_mobility[leaf] = flags & NB_ALLOC_MOBILITY;
+                }
+
+                FAD_RELAXED(&nb_header->alloc_blocks[nb_depth - level], 1);
+
+                if (nb_wmark_orders) {
+                        __nb_wmark_check();
+                }
+
+                return (void*) (nb_base_address + leaf * NB_MIN_SIZE);
+        }
+
+        /* A release occured, try again */
+        if (ts != nb_header->release_count) {
+                NB_COUNT(op_restarts, 1);
+                NB_PROBE2(restart, size, 0);
+                goto nb_alloc_again;
+        }
+
+        /* Blocks are waiting to be released, help out */
+        if (nb_header->deferred_head && nb_reclaim()) {
+                NB_COUNT(op_restarts, 1);
+                NB_PROBE2(restart, size, 1);
+                goto nb_alloc_again;
+        }
+
+#if NB_SCAN_HINT
+        /* A hint may have raced with a release; once more left of it */
+        if (!nb_scan_unhinted) {
+                nb_scan_unhinted = 1;
+                goto nb_alloc_again;
+        }
+#endif
+
+        NB_PROBE2(oom, size, order);
+
+        return (void*) 0;
+}
+
+/* Arguments of the exit probes; only computed while they're traced */
+static void __nb_probe_exit(uint8_t alloc, uint64_t size, void *addr,
+        nb_node_t node)
+{
+        uint32_t order = 0;
+        uint64_t scanned = 0;
+
+        if (node) {
+                order = nb_depth - nb_level(node);
+        } else if (NB_MIN_SIZE < size) {
+                order = LOG2_LOWER(size - 1) + 1 - LOG2_LOWER(NB_MIN_SIZE);
+        }
+
+#if NB_INSTRUMENT
+        scanned = nb_self ? nb_self->op_scanned : 0;
+#endif
+
+        if (alloc) {
+                NB_PROBE4(alloc_exit, size, order, node, scanned);
+        } else {
+                NB_PROBE3(free_exit, addr, order, node);
+        }
+}
+
+/*
+ * Record of the caller if its request should go through a combiner.
+ * Combining is switched on once a thread sees NB_COMBINE_ENTER failed CAS
+ * within NB_COMBINE_WINDOW operations of its own.
+ */
+static struct nb_thread* __nb_combined()
+{
+        if (nb_combine_mode == NB_COMBINE_OFF) {
+                return 0;
+        }
+
+        struct nb_thread *self = __nb_self();
+        if (!self || self->combiner) {
+                return 0;
+        }
+
+        if (nb_combine_mode == NB_COMBINE_AUTO &&
+                        !(++self->ops % NB_COMBINE_WINDOW)) {
+                uint64_t failures = 0;
+                for (uint32_t site = 0; site < NB_SITES; site++) {
+                        failures += self->cas_failures[site];
+                }
+
+                if (NB_COMBINE_ENTER <= failures - self->failures) {
+                        __atomic_store_n(&nb_combining, 1, __ATOMIC_RELAXED);
+                }
+                self->failures = failures;
+        }
+
+        return __atomic_load_n(&nb_combining, __ATOMIC_RELAXED) ? self : 0;
+}
+
+static void __nb_free(void *addr);
+
+#if NB_TAGS
+static void __nb_tag_account(uint16_t tag, uint64_t bytes, uint64_t blocks)
+{
+        struct nb_thread *self = __nb_self();
+        struct nb_tag_shard *shard =
+                &nb_tag_usage[self ? self->id % NB_TAG_SHARDS : 0];
+
+        FAD_RELAXED(&shard->bytes[tag], bytes);
+        FAD_RELAXED(&shard->blocks[tag], blocks);
+}
+#endif
+
+#if NB_PROFILE
+static uint64_t __nb_sample_slot(uint64_t key)
+{
+        return (key / NB_MIN_SIZE * 0x9E3779B97F4A7C15ULL) >>
+                (64 - LOG2_LOWER(NB_PROFILE_SLOTS));
+}
+
+/* Bytes to the next sample; exponential, so samples are a Poisson process */
+static uint64_t __nb_sample_interval(struct nb_thread *self)
+{
+        double u = (double) ((__nb_random(self) >> 11) + 1) / EXP2(53);
+
+        return (uint64_t) (-log(u) * nb_profile_rate) + 1;
+}
+
+/* Every byte has the same chance; the block stands for this many */
+static uint64_t __nb_sample_weight(uint64_t size)
+{
+        return (uint64_t) (size / (1.0 - exp(-(double) size /
+                nb_profile_rate)));
+}
+
+static void* __nb_sample(void *addr)
+{
+        if (!addr || !nb_profile_rate) {
+                return addr;
+        }
+
+        struct nb_thread *self = __nb_self();
+        if (!self) {
+                return addr;
+        }
+
+        uint64_t leaf = ((uint64_t) addr - nb_base_address) / NB_MIN_SIZE;
+        uint32_t order = nb_depth - nb_level(nb_index[leaf]);
+        uint64_t size = EXP2(order) * NB_MIN_SIZE;
+
+        uint32_t epoch = __atomic_load_n(&nb_profile_epoch, __ATOMIC_RELAXED);
+        if (self->sample_epoch != epoch) {
+                self->sample_left = __nb_sample_interval(self);
+                self->sample_epoch = epoch;
+        }
+
+        if (size < self->sample_left) {
+                self->sample_left -= size;
+                return addr;
+        }
+        self->sample_left = __nb_sample_interval(self);
+
+        /* Claim a slot; dropped if the table is full */
+        uint64_t key = (uint64_t) addr;
+        uint64_t slot = __nb_sample_slot(key);
+
+        for (uint32_t i = 0; i < NB_PROFILE_SLOTS; i++) {
+                struct nb_sample *sample =
+                        &nb_samples[(slot + i) % NB_PROFILE_SLOTS];
+                uint64_t old = __atomic_load_n(&sample->key,
+                        __ATOMIC_RELAXED);
+
+                if ((old && old != NB_SAMPLE_TOMB) ||
+                                !BCAS(&sample->key, &old, key | 1)) {
+                        continue;
+                }
+
+                sample->size = size;
+                sample->order = order;
+                sample->depth = backtrace(sample->stack, NB_PROFILE_DEPTH);
+
+                __atomic_store_n(&sample->key, key, __ATOMIC_RELEASE);
+                FAD_RELAXED(&nb_profile_live, 1);
+                break;
+        }
+
+        return addr;
+}
+
+/* Drops the sample of the block, if any */
+static void __nb_unsample(void *addr)
+{
+        if (!__atomic_load_n(&nb_profile_live, __ATOMIC_RELAXED)) {
+                return;
+        }
+
+        uint64_t key = (uint64_t) addr;
+        uint64_t slot = __nb_sample_slot(key);
+
+        for (uint32_t i = 0; i < NB_PROFILE_SLOTS; i++) {
+                struct nb_sample *sample =
+                        &nb_samples[(slot + i) % NB_PROFILE_SLOTS];
+                uint64_t val = __atomic_load_n(&sample->key,
+                        __ATOMIC_ACQUIRE);
+
+                if (!val) {
+                        return;
+                }
+
+                if (val == key) {
+                        __atomic_store_n(&sample->key, NB_SAMPLE_TOMB,
+                                __ATOMIC_RELEASE);
+                        FAD_RELAXED(&nb_profile_live, -1);
+                        return;
+                }
+        }
+}
+
+void nb_profile_set_rate(uint64_t rate)
+{
+        nb_profile_rate = rate;
+        FAD_RELAXED(&nb_profile_epoch, 1);
+}
+
+/*
+ * Folded stacks (e.g. flamegraph.pl), outermost frame first; the block
+ * order is the leaf frame. Frames are raw addresses, see addr2line.
+ */
+int nb_profile_dump(int fd)
+{
+        char line[NB_PROFILE_DEPTH * 20 + 64];
+
+        for (uint32_t i = 0; i < NB_PROFILE_SLOTS; i++) {
+                struct nb_sample *sample = &nb_samples[i];
+                uint64_t key = __atomic_load_n(&sample->key,
+                        __ATOMIC_ACQUIRE);
+
+                if (!key || key == NB_SAMPLE_TOMB || (key & 1)) {
+                        continue;
+                }
+
+                /* Skip the profiler's own frame */
+                int len = 0;
+                for (uint32_t f = sample->depth; 1 < f; f--) {
+                        len += snprintf(line + len, sizeof(line) - len,
+                                "%p;", sample->stack[f - 1]);
+                }
+                len += snprintf(line + len, sizeof(line) - len,
+                        "order_%u %lu\n", sample->order,
+                        (unsigned long) __nb_sample_weight(sample->size));
+
+                /* Freed in the meantime */
+                if (__atomic_load_n(&sample->key, __ATOMIC_ACQUIRE) != key) {
+                        continue;
+                }
+
+                if (write(fd, line, len) != len) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+#else
+static inline void* __nb_sample(void *addr)
+{
+        return addr;
+}
+
+static inline void __nb_unsample(void *addr)
+{
+        (void) addr;
+}
+#endif
+
+#if NB_TRACE
+/* Appends an event to the ring of the calling thread */
+static void __nb_trace(uint16_t op, uint16_t flags, uint64_t size, void *addr)
+{
+        if (!__atomic_load_n(&nb_tracing, __ATOMIC_RELAXED)) {
+                return;
+        }
+
+        struct nb_thread *self = __nb_self();
+        if (!self) {
+                return;
+        }
+
+        if (!self->trace) {
+                self->trace = (struct nb_trace_event*) NB_MALLOC(
+                        NB_TRACE * sizeof(struct nb_trace_event));
+                if (!self->trace) {
+                        return;
+                }
+        }
+
+        /* A new trace started; drop the events of the old one */
+        uint32_t epoch = __atomic_load_n(&nb_trace_epoch, __ATOMIC_RELAXED);
+        if (self->trace_epoch != epoch) {
+                __atomic_store_n(&self->trace_head, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&self->trace_epoch, epoch, __ATOMIC_RELEASE);
+        }
+
+        struct nb_trace_event *event =
+                &self->trace[self->trace_head % NB_TRACE];
+        event->ticks = __nb_ticks();
+        event->size = size;
+        event->block = addr ? (uint64_t) addr - nb_base_address :
+                NB_INVALID_OFFSET;
+        event->thread = self->id;
+        event->op = op;
+        event->flags = flags;
+
+        __atomic_store_n(&self->trace_head, self->trace_head + 1,
+                __ATOMIC_RELEASE);
+}
+
+/* Enabling starts a new trace */
+void nb_set_trace(uint8_t enabled)
+{
+        if (enabled) {
+                FAD_RELAXED(&nb_trace_epoch, 1);
+        }
+
+        __atomic_store_n(&nb_tracing, enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Events still in the rings, thread by thread. Events recorded while the
+ * dump runs may come out torn; stop tracing first for an exact copy.
+ */
+int nb_trace_dump(int fd)
+{
+        struct nb_trace_header header = {
+                .magic = NB_TRACE_MAGIC,
+                .min_size = NB_MIN_SIZE,
+                .total_memory = nb_total_memory,
+                .max_order = NB_MAX_ORDER,
+                .policy = nb_policy,
+        };
+
+        if (write(fd, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+                return 1;
+        }
+
+        uint32_t epoch = __atomic_load_n(&nb_trace_epoch, __ATOMIC_RELAXED);
+
+        struct nb_thread *record = __atomic_load_n(&nb_threads,
+                __ATOMIC_ACQUIRE);
+        for (; record; record = record->next) {
+                if (__atomic_load_n(&record->trace_epoch,
+                                __ATOMIC_ACQUIRE) != epoch) {
+                        continue;
+                }
+
+                uint64_t head = __atomic_load_n(&record->trace_head,
+                        __ATOMIC_ACQUIRE);
+                uint64_t tail = NB_TRACE < head ? head - NB_TRACE : 0;
+
+                /* Oldest first; the ring may wrap once */
+                while (tail < head) {
+                        uint64_t first = tail % NB_TRACE;
+                        uint64_t count = NB_TRACE - first;
+                        if (head - tail < count) {
+                                count = head - tail;
+                        }
+
+                        ssize_t len = count * sizeof(struct nb_trace_event);
+                        if (write(fd, &record->trace[first], len) != len) {
+                                return 1;
+                        }
+                        tail += count;
+                }
+        }
+
+        return 0;
+}
+#else
+static inline void __nb_trace(uint16_t op, uint16_t flags, uint64_t size,
+        void *addr)
+{
+        (void) op;
+        (void) flags;
+        (void) size;
+        (void) addr;
+}
+#endif
+
+/*
+ * Applies the published requests of all threads; under the lock. Each one
+ * runs on the record of its requester, which waits for it meanwhile; its
+ * partition share, backoff & counters are charged, not the combiner's.
+ */
+static void __nb_combine_pass()
+{
+        struct nb_thread *combiner = nb_self;
+        uint64_t served = 0;
+
+        struct nb_thread *record = __atomic_load_n(&nb_threads,
+                __ATOMIC_ACQUIRE);
+        for (; record; record = record->next) {
+                uint32_t op = __atomic_load_n(&record->op, __ATOMIC_ACQUIRE);
+                if (op != NB_OP_ALLOC && op != NB_OP_FREE) {
+                        continue;
+                }
+
+                nb_self = record;
+                if (op == NB_OP_ALLOC) {
+                        record->ret = __nb_alloc(record->arg, record->flags,
+                                record->color);
+                } else {
+                        __nb_free((void*) record->arg);
+                }
+                nb_self = combiner;
+
+                __atomic_store_n(&record->op, 0, __ATOMIC_RELEASE);
+                served++;
+        }
+
+        FAD_RELAXED(&nb_stat_combine, served);
+        nb_combine_passes++;
+        nb_combine_served += served;
+
+        if (nb_combine_served < NB_COMBINE_WINDOW) {
+                return;
+        }
+
+        /* Hardly anyone to combine for; back to lock-free */
+        if (nb_combine_mode == NB_COMBINE_AUTO &&
+                        nb_combine_served < 2 * nb_combine_passes) {
+                __atomic_store_n(&nb_combining, 0, __ATOMIC_RELAXED);
+        }
+
+        nb_combine_passes = 0;
+        nb_combine_served = 0;
+}
+
+/*
+ * Flat combining: the request is published in the record of the thread.
+ * Whoever takes the lock applies the pending requests of all threads, so
+ * only one thread at a time works on the tree (of this process).
+ */
+static void* __nb_combine(struct nb_thread *self, uint32_t op,
+        uint64_t arg, uint32_t flags, uint32_t color)
+{
+        self->arg = arg;
+        self->flags = flags;
+        self->color = color;
+        __atomic_store_n(&self->op, op, __ATOMIC_RELEASE);
+
+        for (uint32_t spins = 1;; spins++) {
+                uint32_t unlocked = 0;
+
+                if (!__atomic_load_n(&nb_combine_lock, __ATOMIC_RELAXED) &&
+                                __atomic_compare_exchange_n(&nb_combine_lock,
+                                &unlocked, 1, 0, __ATOMIC_ACQUIRE,
+                                __ATOMIC_RELAXED)) {
+                        self->combiner = 1;
+                        __nb_combine_pass();
+                        self->combiner = 0;
+
+                        __atomic_store_n(&nb_combine_lock, 0,
+                                __ATOMIC_RELEASE);
+                }
+
+                if (!__atomic_load_n(&self->op, __ATOMIC_ACQUIRE)) {
+                        return self->ret;
+                }
+
+                /* The combiner might not be running */
+                if (spins % NB_BACKOFF_MAX) {
+                        __nb_pause();
+                } else {
+                        sched_yield();
+                }
+        }
+}
+
+/* Entry point of the public allocation APIs */
+static void* __nb_alloc_request(uint64_t size, uint32_t flags, uint32_t color)
+{
+        uint64_t start = __nb_op_begin();
+        NB_PROBE2(alloc_entry, size, flags);
+
+        struct nb_thread *self = __nb_combined();
+        void *addr = __nb_sample(self ?
+                __nb_combine(self, NB_OP_ALLOC, size, flags, color) :
+                __nb_alloc(size, flags, color));
+        __nb_trace(NB_TRACE_ALLOC, flags, size, addr);
+
+        if (NB_PROBE_ENABLED(alloc_exit)) {
+                nb_node_t node = addr ? nb_index[((uint64_t) addr -
+                        nb_base_address) / NB_MIN_SIZE] : 0;
+                __nb_probe_exit(1, size, addr, node);
+        }
+        __nb_op_end(NB_HIST_ALLOC_TICKS, start);
+
+        return addr;
+}
+
+void* nb_alloc(uint64_t size)
+{
+        return __nb_alloc_request(size, 0, NB_COLOR_ANY);
+}
+
+void* nb_alloc_flags(uint64_t size, uint32_t flags)
+{
+        return __nb_alloc_request(size, flags, NB_COLOR_ANY);
+}
+
+#if NB_TAGS
+void* nb_alloc_tagged(uint64_t size, uint16_t tag)
+{
+        if (NB_TAGS <= tag) {
+                return 0;
+        }
+
+        void *addr = nb_alloc(size);
+        if (!addr || !tag || !nb_tag) {
+                return addr;
+        }
+
+        /* Only the owner frees it; no race with the release */
+        uint64_t leaf = ((uint64_t) addr - nb_base_address) / NB_MIN_SIZE;
+        nb_tag[leaf] = tag;
+        __nb_tag_account(tag,
+                EXP2(nb_depth - nb_level(nb_index[leaf])) * NB_MIN_SIZE, 1);
+
+        return addr;
+}
+#endif
+
+void* nb_alloc_colored(uint64_t size, uint32_t color)
+{
+        /* Round-robin over the colors, per thread */
+        if (color == NB_COLOR_NEXT) {
+                struct nb_thread *self = __nb_self();
+                color = self ? self->next_color++ : 0;
+        }
+
+        return __nb_alloc_request(size, 0, color % NB_COLORS);
+}
+
+static void __nb_wait(uint32_t *seq, uint32_t val, uint64_t timeout)
+{
+#if __linux__
+        struct timespec ts = {
+                .tv_sec = timeout / 1000000000ULL,
+                .tv_nsec = timeout % 1000000000ULL
+        };
+
+        /* Not private; waiters may be in other processes */
+        syscall(SYS_futex, seq, FUTEX_WAIT, val, &ts, 0, 0);
+#else
+        /* No futex; poll */
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000 };
+        (void) seq;
+        (void) val;
+        (void) timeout;
+        nanosleep(&ts, 0);
+#endif
+}
+
+static void __nb_wake(nb_node_t node)
+{
+        /* Largest block the release coalesced into */
+        nb_node_t top = __nb_free_top(node);
+        if (!top) {
+                return;
+        }
+
+        uint32_t top_order = nb_depth - nb_level(top);
+
+        for (uint32_t order = 0; order <= top_order; order++) {
+                if (!__atomic_load_n(&nb_header->order_waiters[order],
+                                __ATOMIC_SEQ_CST)) {
+                        continue;
+                }
+
+                FAD(&nb_header->wake_seq[order], 1);
+
+#if __linux__
+                /* One waiter per block that fits */
+                uint64_t count = EXP2(top_order - order);
+                syscall(SYS_futex, &nb_header->wake_seq[order], FUTEX_WAKE,
+                        count < INT_MAX ? (int) count : INT_MAX, 0, 0, 0);
+#endif
+        }
+}
+
+/* Nothing to pay unless someone is blocked (see nb_alloc_wait) */
+static void __nb_notify(nb_node_t node)
+{
+        MB_AFTER_RMW();
+        if (__atomic_load_n(&nb_header->waiters, __ATOMIC_SEQ_CST)) {
+                __nb_wake(node);
+        }
+}
+
+void* nb_alloc_wait(uint64_t size, uint64_t timeout)
+{
+        void *addr = nb_alloc(size);
+        if (addr || nb_max_size < size) {
+                return addr;
+        }
+
+        if (size < NB_MIN_SIZE) {
+                size = NB_MIN_SIZE;
+        }
+
+        uint32_t level = LOG2_LOWER(nb_total_memory / size);
+        if (nb_depth < level) {
+                level = nb_depth;
+        }
+        uint32_t order = nb_depth - level;
+
+        uint64_t start = __nb_now();
+
+        FAD(&nb_header->waiters, 1);
+        FAD(&nb_header->order_waiters[order], 1);
+
+        /* Pairs with nb_free; either it sees the waiter or we see the block */
+        MB_AFTER_RMW();
+
+        for (;;) {
+                /* Read before retrying so a release in between is not lost */
+                uint32_t seq = __atomic_load_n(&nb_header->wake_seq[order],
+                        __ATOMIC_SEQ_CST);
+
+                addr = nb_alloc(size);
+                if (addr) {
+                        break;
+                }
+
+                uint64_t elapsed = __nb_now() - start;
+                if (timeout <= elapsed) {
+                        break;
+                }
+
+                __nb_wait(&nb_header->wake_seq[order], seq, timeout - elapsed);
+        }
+
+        FAD(&nb_header->order_waiters[order], -1);
+        FAD(&nb_header->waiters, -1);
+
+        return addr;
+}
+
+void* nb_alloc_zeroed(uint64_t size)
+{
+        void *addr = nb_alloc(size);
+        if (!addr) {
+                return 0;
+        }
+
+        uint64_t leaf = ((uint64_t) addr - nb_base_address) / NB_MIN_SIZE;
+        __nb_zero_pages(leaf, EXP2(nb_depth - nb_level(nb_index[leaf])));
+
+        return addr;
+}
+
+void __nb_unmark(nb_node_t node, uint32_t upper_bound)
+{
+        nb_node_t current = node;
+        nb_node_t child = 0;
+
+        uint8_t curr_val = 0;
+        uint8_t new_val = 0;
+
+        do {
+                child = current;
+                current = current >> 1;
+                NB_COUNT(op_climbed, 1);
+
+                do {
+                        curr_val = nb_tree[current];
+
+                        if (!nb_is_coal(curr_val, child)) {
+                                return;
+                        }
+                        
+                        new_val = nb_unmark(curr_val, child);
+                } while (!BCAS(&nb_tree[current], &curr_val, new_val) &&
+                        __nb_contended(NB_SITE_UNMARK));
+        } while (upper_bound < nb_level(current) &&
+                        !nb_is_occ_buddy(new_val, child));
+}
+
+void __nb_freenode(nb_node_t node, uint32_t upper_bound)
+{
+        /* TODO: should I check for double frees? */
+        if (nb_is_free(nb_tree[node])) {
+                return;
+        }
+
+        __nb_uncontended();
+
+        /* Phase 1. Ancestors of the node are marked as coalescing */
+        nb_node_t current = node >> 1;
+        nb_node_t child = node;
+
+        while (nb_base_level < nb_level(child)) {
+                uint8_t curr_val = 0;
+                uint8_t new_val = 0;
+
+                /* On success, curr_val holds the value that was replaced */
+                do {
+                        curr_val = nb_tree[current];
+                        new_val = nb_set_coal(curr_val, child);
+                } while (!BCAS(&nb_tree[current], &curr_val, new_val) &&
+                        __nb_contended(NB_SITE_COALESCE));
+
+                /*
+                 * The buddy stays occupied, so the release can't merge past
+                 * here. A buddy that is itself being released may still
+                 * finish first; keep marking, or its unmark stops short.
+                 */
+                if (nb_is_occ_buddy(curr_val, child) &&
+                        !nb_is_coal_buddy(curr_val, child)) {
+                        break;
+                }
+
+                child = current;
+                current = current >> 1;
+                NB_COUNT(op_climbed, 1);
+        }
+
+        /* Phase 2. Mark the node as free */
+        __atomic_store_n(&nb_tree[node], 0, __ATOMIC_RELEASE);
+
+        /* Phase 3. Propagate node release upward and possibly merge buddies */
+        if (nb_level(node) != nb_base_level) {
+                __nb_unmark(node, upper_bound);
+        }
+
+        __nb_hint_lower(node);
+}
+
+nb_node_t __nb_free_top(nb_node_t node)
+{
+        if (!nb_is_free(nb_tree[node])) {
+                return 0;
+        }
+
+        /* Climb while the buddy is free as well */
+        while (nb_base_level < nb_level(node) &&
+                        nb_is_free(nb_tree[node >> 1])) {
+                node = node >> 1;
+        }
+
+        return node;
+}
+
+static void __nb_free(void *addr)
+{
+        uint64_t n = ((uint64_t) addr - nb_base_address) / NB_MIN_SIZE;
+        nb_node_t node = nb_index[n];
+
+        /* Not a block of the caller */
+        if (node & NB_INDEX_RESERVED) {
+                return;
+        }
+
+        __nb_unsample(addr);
+
+#if NB_TAGS
+        if (nb_tag && nb_tag[n]) {
+                __nb_tag_account(nb_tag[n],
+                        -(EXP2(nb_depth - nb_level(node)) * NB_MIN_SIZE), -1);
+                nb_tag[n] = 0;
+        }
+#endif
+
+        if (nb_mobility && nb_mobility[n]) {
+                nb_mobility[n] = 0;
+        }
+
+        /* Owner might've written to it */
+        __nb_mark_pages(n, EXP2(nb_depth - nb_level(node)), 1);
+        __nb_freenode(node, nb_base_level);
+
+        FAD_RELAXED(&nb_header->release_count, 1);
+        FAD_RELAXED(&nb_header->alloc_blocks[nb_depth - nb_level(node)], -1);
+
+        if (nb_wmark_below) {
+                __nb_wmark_check();
+        }
+
+        __nb_notify(node);
+
+        if (nb_arena_mmap) {
+                __nb_release(node);
+        }
+}
+
+void nb_free(void *addr)
+{
+        if (!addr) {
+                return;
+        }
+
+        uint64_t start = __nb_op_begin();
+        NB_PROBE1(free_entry, addr);
+        __nb_trace(NB_TRACE_FREE, 0, 0, addr);
+
+        /* Once released, the block may be handed out & indexed again */
+        nb_node_t node = 0;
+        if (NB_PROBE_ENABLED(free_exit)) {
+                node = nb_index[((uint64_t) addr - nb_base_address) /
+                        NB_MIN_SIZE];
+        }
+
+        struct nb_thread *self = __nb_combined();
+        if (self) {
+                __nb_combine(self, NB_OP_FREE, (uint64_t) addr, 0,
+                        NB_COLOR_ANY);
+        } else {
+                __nb_free(addr);
+        }
+
+        if (NB_PROBE_ENABLED(free_exit)) {
+                __nb_probe_exit(0, 0, addr, node);
+        }
+        __nb_op_end(NB_HIST_FREE_TICKS, start);
+}
+
+void nb_free_deferred(void *addr)
+{
+        if (!addr) {
+                return;
+        }
+
+        /* Traced as a free; the release comes later (see nb_reclaim) */
+        __nb_trace(NB_TRACE_FREE, 0, 0, addr);
+
+        uint64_t offset = (uint64_t) addr - nb_base_address;
+        nb_node_t node = nb_index[offset / NB_MIN_SIZE];
+
+        /* Not a block of the caller; it isn't ours to link through either */
+        if (node & NB_INDEX_RESERVED) {
+                return;
+        }
+
+        FAD_RELAXED(&nb_header->deferred_bytes,
+                EXP2(nb_depth - nb_level(node)) * NB_MIN_SIZE);
+
+        /* Link through the block itself; offsets work across processes */
+        uint64_t *next = (uint64_t*) addr;
+        uint64_t head = nb_header->deferred_head;
+
+        do {
+                *next = head;
+        } while (!BCAS(&nb_header->deferred_head, &head, offset + 1));
+}
+
+static int __nb_offset_cmp(const void *a, const void *b)
+{
+        uint64_t lhs = *(const uint64_t*) a;
+        uint64_t rhs = *(const uint64_t*) b;
+
+        return (lhs > rhs) - (lhs < rhs);
+}
+
+uint64_t nb_reclaim()
+{
+        uint64_t batch[NB_DEFER_BATCH];
+        uint64_t count = 0;
+
+        /* Take the whole queue; concurrent reclaimers get disjoint lists */
+        uint64_t head = __atomic_exchange_n(&nb_header->deferred_head, 0,
+                __ATOMIC_ACQ_REL);
+
+        while (head) {
+                uint64_t n = 0;
+
+                for (; head && n < NB_DEFER_BATCH; n++) {
+                        batch[n] = head - 1;
+                        head = *(uint64_t*) (nb_base_address + head - 1);
+                }
+
+                /* Buddies end up next to each other */
+                qsort(batch, n, sizeof(uint64_t), __nb_offset_cmp);
+
+                for (uint64_t i = 0; i < n; i++) {
+                        nb_node_t node = nb_index[batch[i] / NB_MIN_SIZE];
+
+                        FAD_RELAXED(&nb_header->deferred_bytes,
+                                -(EXP2(nb_depth - nb_level(node)) *
+                                NB_MIN_SIZE));
+                        __nb_free((void*) (nb_base_address + batch[i]));
+                }
+
+                count += n;
+        }
+
+        /* Releases held back by the rate limit while frees went quiet */
+        if (nb_arena_mmap && __nb_release_queued() &&
+                        __nb_release_slot()) {
+                __nb_release_pending();
+        }
+
+        return count;
+}
+
+static uint64_t __nb_scrub(nb_node_t node, uint64_t budget)
+{
+        uint8_t val = nb_tree[node];
+        uint32_t level = nb_level(node);
+
+        if (val & OCC) {
+                return 0;
+        }
+
+        uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+        uint64_t pages = EXP2(nb_depth - level);
+
+        if (nb_is_free(val) && !__nb_any_dirty(leaf, pages)) {
+                return 0;
+        }
+
+        /* Largest free block within the budget; own it while it's zeroed */
+        if (nb_is_free(val) && pages <= budget) {
+                if (__nb_try_alloc(node)) {
+                        return 0;
+                }
+
+                uint64_t cleaned = __nb_zero_pages(leaf, pages);
+
+                __nb_freenode(node, nb_base_level);
+                FAD_RELAXED(&nb_header->release_count, 1);
+                __nb_notify(node);
+
+                return cleaned;
+        }
+
+        if (level == nb_depth) {
+                return 0;
+        }
+
+        uint64_t cleaned = __nb_scrub(node << 1, budget);
+        if (cleaned < budget) {
+                cleaned += __nb_scrub((node << 1) + 1, budget - cleaned);
+        }
+
+        return cleaned;
+}
+
+uint64_t nb_scrub(uint64_t budget)
+{
+        uint64_t pages = budget / NB_MIN_SIZE;
+        uint64_t cleaned = 0;
+        nb_node_t count = EXP2(nb_base_level);
+        nb_node_t start = nb_scrub_cursor;
+
+        /* Continue after the block the last pass ended in */
+        for (nb_node_t i = 0; i < count && cleaned < pages; i++) {
+                nb_node_t slot = (start + i) % count;
+
+                cleaned += __nb_scrub(count + slot, pages - cleaned);
+                nb_scrub_cursor = (slot + 1) % count;
+        }
+
+        return cleaned * NB_MIN_SIZE;
+}
+
+/* Only blocks allocated with NB_ALLOC_MOVABLE are relocated */
+static inline uint8_t __nb_movable(uint64_t leaf)
+{
+        return nb_mobility && !(nb_index[leaf] & NB_INDEX_RESERVED) &&
+                nb_mobility[leaf] == NB_ALLOC_MOVABLE;
+}
+
+/* Bytes allocated within the subtree */
+static uint64_t __nb_used_bytes(nb_node_t node)
+{
+        uint8_t val = nb_tree[node];
+
+        if (val & OCC) {
+                uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+
+                /* Can't be moved; more than the subtree can hold */
+                if (!__nb_movable(leaf)) {
+                        return nb_total_memory;
+                }
+
+                return EXP2(nb_depth - nb_level(node)) * NB_MIN_SIZE;
+        }
+
+        uint64_t used = 0;
+
+        if (nb_level(node) < nb_depth) {
+                if (val & OCC_LEFT) {
+                        used += __nb_used_bytes(node << 1);
+                }
+                if (val & OCC_RIGHT) {
+                        used += __nb_used_bytes((node << 1) + 1);
+                }
+        }
+
+        return used;
+}
+
+/* Occupies the free holes of the subtree so nothing new lands there */
+static void __nb_compact_fill(nb_node_t node, uint64_t first, uint64_t *fillers)
+{
+        uint8_t val = nb_tree[node];
+
+        if (val & OCC) {
+                return;
+        }
+
+        if (nb_is_free(val)) {
+                if (!__nb_try_alloc(node)) {
+                        uint64_t leaf = __nb_leftmost(node, nb_depth) -
+                                EXP2(nb_depth);
+
+                        nb_index[leaf] = node;
+                        fillers[(leaf - first) / 64] |=
+                                EXP2((leaf - first) % 64);
+                }
+
+                return;
+        }
+
+        if (nb_level(node) < nb_depth) {
+                __nb_compact_fill(node << 1, first, fillers);
+                __nb_compact_fill((node << 1) + 1, first, fillers);
+        }
+}
+
+/* Leftmost movable block of the subtree, fillers & refused ones aside */
+static nb_node_t __nb_compact_victim(nb_node_t node, uint64_t first,
+        uint64_t *fillers, uint64_t *refused)
+{
+        uint8_t val = nb_tree[node];
+
+        if (val & OCC) {
+                uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+
+                uint64_t bit = leaf - first;
+
+                if ((fillers[bit / 64] & EXP2(bit % 64)) ||
+                                (refused[bit / 64] & EXP2(bit % 64)) ||
+                                !__nb_movable(leaf)) {
+                        return 0;
+                }
+
+                return node;
+        }
+
+        if (nb_is_free(val) || nb_level(node) == nb_depth) {
+                return 0;
+        }
+
+        nb_node_t victim = 0;
+
+        if (val & OCC_LEFT) {
+                victim = __nb_compact_victim(node << 1, first, fillers,
+                        refused);
+        }
+        if (!victim && (val & OCC_RIGHT)) {
+                victim = __nb_compact_victim((node << 1) + 1, first, fillers,
+                        refused);
+        }
+
+        return victim;
+}
+
+/* Cheapest subtree to evacuate at the level */
+static nb_node_t __nb_compact_pick(uint32_t level)
+{
+        nb_node_t best = 0;
+        uint64_t best_used = ~0ULL;
+
+        for (nb_node_t n = EXP2(level); n < EXP2(level + 1); n++) {
+                /* Nothing to gain from a block of the same order */
+                if (nb_tree[n] & OCC) {
+                        continue;
+                }
+
+                /* Covered by a larger allocated block */
+                nb_node_t current = n;
+                while (nb_base_level < nb_level(current) &&
+                                !(nb_tree[current >> 1] & OCC)) {
+                        current = current >> 1;
+                }
+
+                if (nb_level(current) != nb_base_level) {
+                        continue;
+                }
+
+                /* Pinned blocks live there */
+                if (nb_owner && nb_owner[current - EXP2(nb_base_level)] ==
+                                NB_ALLOC_UNMOVABLE) {
+                        continue;
+                }
+
+                /* Full, or holds blocks that can't be moved */
+                uint64_t used = __nb_used_bytes(n);
+                if (EXP2(nb_depth - level) * NB_MIN_SIZE <= used) {
+                        continue;
+                }
+
+                if (used < best_used) {
+                        best = n;
+                        best_used = used;
+                }
+        }
+
+        return best;
+}
+
+int nb_compact(uint32_t order,
+        int (*relocate)(void *dst, void *src, uint64_t size, void *ctx),
+        void *ctx, uint64_t budget)
+{
+        if (NB_MAX_ORDER < order || nb_depth < order || !relocate) {
+                return NB_COMPACT_FAIL;
+        }
+
+        if (nb_stat_free_blocks(order)) {
+                return NB_COMPACT_DONE;
+        }
+
+        nb_node_t node = __nb_compact_pick(nb_depth - order);
+        if (!node) {
+                return NB_COMPACT_FAIL;
+        }
+
+        uint64_t first = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+        uint64_t last = first + EXP2(order);
+        uint64_t fillers[(EXP2(NB_MAX_ORDER) + 63) / 64] = {0};
+        uint64_t refused[(EXP2(NB_MAX_ORDER) + 63) / 64] = {0};
+
+        uint64_t start = __nb_now();
+        int res = NB_COMPACT_DONE;
+
+        for (;;) {
+                __nb_compact_fill(node, first, fillers);
+
+                nb_node_t victim = __nb_compact_victim(node, first, fillers,
+                        refused);
+                if (!victim) {
+                        break;
+                }
+
+                uint64_t leaf = __nb_leftmost(victim, nb_depth) -
+                        EXP2(nb_depth);
+                uint64_t size = EXP2(nb_depth - nb_level(victim)) *
+                        NB_MIN_SIZE;
+                void *src = (void*) (nb_base_address + leaf * NB_MIN_SIZE);
+
+                /* Net zero once the source is released */
+                void *dst = nb_alloc_flags(size,
+                        NB_ALLOC_RESERVE | NB_ALLOC_MOVABLE);
+                if (!dst) {
+                        res = NB_COMPACT_FAIL;
+                        break;
+                }
+
+                /* A hole was freed in the meantime; try again later */
+                uint64_t dst_leaf = ((uint64_t) dst - nb_base_address) /
+                        NB_MIN_SIZE;
+                if (first <= dst_leaf && dst_leaf < last) {
+                        nb_free(dst);
+                        res = NB_COMPACT_PARTIAL;
+                        break;
+                }
+
+                /* Refused; leave it in place & move the others */
+                if (relocate(dst, src, size, ctx)) {
+                        nb_free(dst);
+                        refused[(leaf - first) / 64] |=
+                                EXP2((leaf - first) % 64);
+                        res = NB_COMPACT_FAIL;
+                } else {
+                        nb_free(src);
+                }
+
+                /* A refused block keeps the subtree from being freed anyway */
+                if (budget <= __nb_now() - start) {
+                        if (res != NB_COMPACT_FAIL) {
+                                res = NB_COMPACT_PARTIAL;
+                        }
+                        break;
+                }
+        }
+
+        /* Release the fillers; the subtree coalesces if it was evacuated */
+        for (uint64_t i = 0; i < EXP2(order); i++) {
+                if (fillers[i / 64] & EXP2(i % 64)) {
+                        __nb_freenode(nb_index[first + i], nb_base_level);
+                        FAD_RELAXED(&nb_header->release_count, 1);
+                        __nb_notify(nb_index[first + i]);
+                }
+        }
+
+        if (res == NB_COMPACT_DONE && !nb_is_free(nb_tree[node])) {
+                res = NB_COMPACT_PARTIAL;
+        }
+
+        return res;
+}
+
+/* Releases the offline blocks of the subtree */
+static void __nb_online(nb_node_t node)
+{
+        uint8_t val = nb_tree[node];
+
+        if (val & OCC) {
+                uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+
+                if (nb_index[leaf] != (node | NB_INDEX_OFFLINE)) {
+                        return;
+                }
+
+                __nb_freenode(node, nb_base_level);
+                FAD_RELAXED(&nb_header->release_count, 1);
+                FAD_RELAXED(&nb_header->reserved_bytes,
+                        -(EXP2(nb_depth - nb_level(node)) * NB_MIN_SIZE));
+
+                __nb_notify(node);
+
+                return;
+        }
+
+        if (nb_is_free(val) || nb_level(node) == nb_depth) {
+                return;
+        }
+
+        if (val & OCC_LEFT) {
+                __nb_online(node << 1);
+        }
+        if (val & OCC_RIGHT) {
+                __nb_online((node << 1) + 1);
+        }
+}
+
+/* Reserves the free holes of the subtree; non-zero while blocks are in use */
+static uint8_t __nb_offline(nb_node_t node)
+{
+        uint8_t val = nb_tree[node];
+        uint64_t leaf = __nb_leftmost(node, nb_depth) - EXP2(nb_depth);
+
+        /* Reserved ones stay reserved; neither is in use */
+        if (val & OCC) {
+                return !__nb_is_reserved(node, leaf);
+        }
+
+        if (nb_is_free(val)) {
+                /* Raced with an allocation; look again on the next pass */
+                if (__nb_try_alloc(node)) {
+                        return 1;
+                }
+
+                nb_index[leaf] = node | NB_INDEX_OFFLINE;
+                FAD_RELAXED(&nb_header->reserved_bytes,
+                        EXP2(nb_depth - nb_level(node)) * NB_MIN_SIZE);
+
+                return 0;
+        }
+
+        if (nb_level(node) == nb_depth) {
+                return 1;
+        }
+
+        uint8_t busy = __nb_offline(node << 1);
+        busy |= __nb_offline((node << 1) + 1);
+
+        return busy;
+}
+
+/* Base level blocks of [addr, addr + size); 0 if not aligned to them */
+static nb_node_t __nb_region_blocks(uint64_t addr, uint64_t size,
+        nb_node_t *first)
+{
+        uint64_t span = EXP2(nb_depth) * NB_MIN_SIZE;
+
+        if (!size || addr < nb_base_address ||
+                        nb_base_address + span - addr < size ||
+                        (addr - nb_base_address) % nb_max_size ||
+                        size % nb_max_size) {
+                return 0;
+        }
+
+        *first = EXP2(nb_base_level) + (addr - nb_base_address) / nb_max_size;
+
+        return size / nb_max_size;
+}
+
+int nb_add_region(uint64_t addr, uint64_t size)
+{
+        nb_node_t first = 0;
+        nb_node_t count = __nb_region_blocks(addr, size, &first);
+
+        if (!count) {
+                return 1;
+        }
+
+        for (nb_node_t i = 0; i < count; i++) {
+                __nb_online(first + i);
+        }
+
+        return 0;
+}
+
+int nb_offline_region(uint64_t addr, uint64_t size, uint64_t timeout)
+{
+        nb_node_t first = 0;
+        nb_node_t count = __nb_region_blocks(addr, size, &first);
+
+        if (!count) {
+                return 1;
+        }
+
+        uint64_t start = __nb_now();
+        int res = 0;
+
+        /* Every release wakes order 0 waiters (see __nb_wake) */
+        FAD(&nb_header->waiters, 1);
+        FAD(&nb_header->order_waiters[0], 1);
+        MB_AFTER_RMW();
+
+        for (;;) {
+                uint32_t seq = __atomic_load_n(&nb_header->wake_seq[0],
+                        __ATOMIC_SEQ_CST);
+                uint8_t busy = 0;
+
+                for (nb_node_t i = 0; i < count; i++) {
+                        busy |= __nb_offline(first + i);
+                }
+
+                if (!busy) {
+                        break;
+                }
+
+                /* Stays fenced; call again or bring it back online */
+                uint64_t elapsed = __nb_now() - start;
+                if (timeout <= elapsed) {
+                        res = 1;
+                        break;
+                }
+
+                /* Until a slice passes or something is released */
+                uint64_t slice = timeout - elapsed;
+                if (NB_OFFLINE_POLL < slice) {
+                        slice = NB_OFFLINE_POLL;
+                }
+
+                __nb_wait(&nb_header->wake_seq[0], seq, slice);
+        }
+
+        FAD(&nb_header->order_waiters[0], -1);
+        FAD(&nb_header->waiters, -1);
+
+        return res;
+}
+
+/* ------------------------------ STATISTICS -------------------------------- */
+
+uint64_t nb_stat_min_size()
+{
+        return NB_MIN_SIZE;
+}
+
+uint32_t nb_stat_max_order()
+{
+        return NB_MAX_ORDER;
+}
+
+uint64_t nb_stat_tree_size()
+{
+        return nb_tree_size;
+}
+
+uint64_t nb_stat_index_size()
+{
+        return nb_index_size;
+}
+
+uint32_t nb_stat_depth()
+{
+        return nb_depth;
+}
+
+uint32_t nb_stat_base_level()
+{
+        return nb_base_level;
+}
+
+uint64_t nb_stat_max_size()
+{
+        return nb_max_size;
+}
+
+uint32_t nb_stat_release_count()
+{
+        return nb_header->release_count;
+}
+
+
+uint64_t nb_stat_total_memory()
+{
+        return nb_total_memory - nb_header->reserved_bytes;
+}
+
+uint64_t nb_stat_used_memory()
+{
+        uint64_t used_memory = 0;
+
+        for (uint32_t i = 0; i <= NB_MAX_ORDER; i++) {
+                used_memory += nb_header->alloc_blocks[i] *
+                        nb_stat_block_size(i);
+        }
+
+        return used_memory;
+}
+
+uint64_t nb_stat_committed_memory()
+{
+        return nb_arena_mmap ? nb_stat_committed : nb_total_memory;
+}
+
+uint64_t nb_stat_released_memory()
+{
+        return nb_stat_released;
+}
+
+uint64_t nb_stat_deferred_memory()
+{
+        return nb_header->deferred_bytes;
+}
+
+/* Free nodes at the level that are not covered by a larger allocated block */
+static uint64_t __nb_count_free(uint32_t level)
+{
+        uint64_t count = 0;
+
+        for (nb_node_t r = EXP2(level); r < EXP2(level + 1); r++) {
+                if (!nb_is_free(nb_tree[r])) {
+                        continue;
+                }
+
+                nb_node_t current = r;
+                while (nb_base_level < nb_level(current) &&
+                                !(nb_tree[current >> 1] & OCC)) {
+                        current = current >> 1;
+                }
+
+                if (nb_level(current) == nb_base_level) {
+                        count++;
+                }
+        }
+
+        return count;
+}
+
+uint64_t nb_stat_huge_free()
+{
+        return __nb_count_free(nb_huge_level);
+}
+
+uint64_t nb_stat_free_blocks(uint32_t order)
+{
+        if (NB_MAX_ORDER < order) {
+                return 0;
+        }
+
+        return __nb_count_free(nb_depth - order);
+}
+
+uint64_t nb_stat_mobility_regions(uint32_t flags)
+{
+        uint64_t count = 0;
+        nb_node_t start = EXP2(nb_base_level);
+
+        if (!nb_owner) {
+                return 0;
+        }
+
+        for (nb_node_t r = start; r < 2 * start; r++) {
+                if (nb_owner[r - start] == (flags & NB_ALLOC_MOBILITY) &&
+                                !nb_is_free(nb_tree[r])) {
+                        count++;
+                }
+        }
+
+        return count;
+}
+
+uint64_t nb_stat_combined()
+{
+        return nb_stat_combine;
+}
+
+#if NB_TAGS
+uint64_t nb_stat_tag_usage(uint16_t tag)
+{
+        uint64_t bytes = 0;
+
+        if (NB_TAGS <= tag) {
+                return 0;
+        }
+
+        for (uint32_t i = 0; i < NB_TAG_SHARDS; i++) {
+                bytes += __atomic_load_n(&nb_tag_usage[i].bytes[tag],
+                        __ATOMIC_RELAXED);
+        }
+
+        return bytes;
+}
+
+uint64_t nb_stat_tag_blocks(uint16_t tag)
+{
+        uint64_t blocks = 0;
+
+        if (NB_TAGS <= tag) {
+                return 0;
+        }
+
+        for (uint32_t i = 0; i < NB_TAG_SHARDS; i++) {
+                blocks += __atomic_load_n(&nb_tag_usage[i].blocks[tag],
+                        __ATOMIC_RELAXED);
+        }
+
+        return blocks;
+}
+#endif
+
+#if NB_INSTRUMENT
+int nb_stat_histogram(uint32_t hist, uint64_t *buckets)
+{
+        if (NB_HISTS <= hist || !buckets) {
+                return 1;
+        }
+
+        memset((void*) buckets, 0x0, NB_HIST_BUCKETS * sizeof(uint64_t));
+
+        /* Exited threads included */
+        struct nb_thread *record = __atomic_load_n(&nb_threads,
+                __ATOMIC_ACQUIRE);
+        for (; record; record = record->next) {
+                for (uint32_t i = 0; i < NB_HIST_BUCKETS; i++) {
+                        buckets[i] += __atomic_load_n(&record->hist[hist][i],
+                                __ATOMIC_RELAXED);
+                }
+        }
+
+        return 0;
+}
+#endif
+
+uint64_t nb_stat_cas_failures(uint32_t site)
+{
+        uint64_t count = 0;
+
+        if (NB_SITES <= site) {
+                return 0;
+        }
+
+        /* Exited threads included */
+        struct nb_thread *record = __atomic_load_n(&nb_threads,
+                __ATOMIC_ACQUIRE);
+        for (; record; record = record->next) {
+                count += __atomic_load_n(&record->cas_failures[site],
+                        __ATOMIC_RELAXED);
+        }
+
+        return count;
 }
 
 uint64_t nb_stat_block_size(uint32_t order)
@@ -343,7 +3724,7 @@ uint64_t nb_stat_total_blocks(uint32_t order)
                 return 0;
         }
 
-        return nb_total_memory / nb_stat_block_size(order);
+        return nb_stat_total_memory() / nb_stat_block_size(order);
 }
 
 uint64_t nb_stat_used_blocks(uint32_t order)
@@ -352,7 +3733,7 @@ uint64_t nb_stat_used_blocks(uint32_t order)
                 return 0;
         }
         
-        return nb_stat_alloc_blocks[order];
+        return nb_header->alloc_blocks[order];
 }
 
 
@@ -362,10 +3743,10 @@ uint8_t nb_stat_occupancy_map(uint8_t *buff, uint32_t order)
                 return 1;
         }
 
-        uint32_t start_node = EXP2(nb_depth - order);
-        uint32_t end_node = EXP2(nb_depth - order + 1);
+        nb_node_t start_node = EXP2(nb_depth - order);
+        nb_node_t end_node = EXP2(nb_depth - order + 1);
 
-        for (uint32_t i = start_node; i < end_node; i++) {
+        for (nb_node_t i = start_node; i < end_node; i++) {
                 buff[i - start_node] = !nb_is_free(nb_tree[i]);
         }
 
@@ -42,10 +42,263 @@ extern "C" {
  * Configuration
  */
 
-#define NB_MIN_SIZE 4096ULL /* bytes */
-#define NB_MAX_ORDER 9U
+#ifndef NB_MIN_SIZE
+        #define NB_MIN_SIZE 4096ULL /* bytes */
+#endif
+#ifndef NB_MAX_ORDER
+        #define NB_MAX_ORDER 9U
+#endif
 #define NB_MALLOC(size) malloc(size)
 
+/*
+ * Node ids
+ *
+ * 32 bits by default; nb_init fails if the tree has more than 2^30 nodes.
+ * Define NB_NODE_64 for larger arenas or smaller NB_MIN_SIZE values.
+ */
+
+#ifdef NB_NODE_64
+        typedef uint64_t nb_node_t;
+#else
+        typedef uint32_t nb_node_t;
+#endif
+
+/*
+ * Arena release (see nb_init_mmap)
+ *
+ * NB_RELEASE_ORDER: Free blocks of this order and above are given back to OS
+ * NB_RELEASE_INTERVAL: Minimum time between two consecutive releases
+ * NB_RELEASE_PENDING: Releases held back by the interval, retried later
+ * NB_RELEASE_LAZY: Use MADV_FREE instead of MADV_DONTNEED
+ */
+
+#define NB_RELEASE_ORDER NB_MAX_ORDER
+#define NB_RELEASE_INTERVAL 1000000ULL /* nanoseconds */
+#define NB_RELEASE_PENDING 64U
+#define NB_RELEASE_LAZY 0
+
+/*
+ * Zeroing (see nb_alloc_zeroed)
+ *
+ * NB_NT_THRESHOLD: Blocks of this size and above are cleared with
+ *                  non-temporal stores where available
+ */
+
+#define NB_NT_THRESHOLD (256ULL * 1024) /* bytes */
+
+/*
+ * Deferred release (see nb_free_deferred)
+ *
+ * NB_DEFER_BATCH: Blocks sorted & released together by nb_reclaim
+ */
+
+#define NB_DEFER_BATCH 64U
+
+/*
+ * Contention management
+ *
+ * NB_BACKOFF_MIN: First backoff window after a failed CAS; pauses
+ * NB_BACKOFF_MAX: Largest window; threads yield the CPU beyond it
+ *
+ * CAS sites (see nb_stat_cas_failures):
+ * NB_SITE_OCCUPY: Taking a free node (nb_alloc); lost races aren't retried
+ * NB_SITE_MARK: Marking the ancestors occupied (nb_alloc)
+ * NB_SITE_COALESCE: Marking the ancestors coalescing (nb_free)
+ * NB_SITE_UNMARK: Clearing the marks of the ancestors (nb_free)
+ */
+
+#define NB_BACKOFF_MIN 4U
+#define NB_BACKOFF_MAX 1024U
+
+#define NB_SITE_OCCUPY 0U
+#define NB_SITE_MARK 1U
+#define NB_SITE_COALESCE 2U
+#define NB_SITE_UNMARK 3U
+#define NB_SITES 4U
+
+/*
+ * Flat combining (see nb_set_combining)
+ *
+ * NB_COMBINE_OFF: Always lock-free (default)
+ * NB_COMBINE_ON: Always through a combiner
+ * NB_COMBINE_AUTO: Combine while the CAS failure rate is high
+ *
+ * NB_COMBINE_WINDOW: Operations between two rate checks
+ * NB_COMBINE_ENTER: Failed CAS per window (of a thread) that switch it on
+ */
+
+#define NB_COMBINE_OFF 0U
+#define NB_COMBINE_ON 1U
+#define NB_COMBINE_AUTO 2U
+
+#define NB_COMBINE_WINDOW 1024U
+#define NB_COMBINE_ENTER 256U
+
+/*
+ * Page coloring (see nb_alloc_colored)
+ *
+ * NB_COLORS: Number of colors; a power of two, e.g., LLC size / (ways *
+ *            NB_MIN_SIZE). Blocks of this many pages & above span them all
+ * NB_COLOR_NEXT: Next color of the calling thread (round-robin)
+ */
+
+#define NB_COLORS 32U
+#define NB_COLOR_NEXT (~0U)
+
+/*
+ * Owner tags (see nb_alloc_tagged)
+ *
+ * NB_TAGS: Number of tags; 0 leaves the tag store out (default)
+ * NB_TAG_SHARDS: Copies of the per-tag counters; threads are spread over them
+ */
+
+#ifndef NB_TAGS
+        #define NB_TAGS 0U
+#endif
+#define NB_TAG_SHARDS 16U
+
+/*
+ * Heap profiler (see nb_profile_dump)
+ *
+ * NB_PROFILE: Compile the sampling profiler in; 0 (default) leaves it out
+ * NB_PROFILE_RATE: Mean bytes allocated between two samples
+ * NB_PROFILE_SLOTS: Live samples kept at most; a power of two
+ * NB_PROFILE_DEPTH: Frames captured per sample
+ */
+
+#ifndef NB_PROFILE
+        #define NB_PROFILE 0
+#endif
+#define NB_PROFILE_RATE (512ULL * 1024) /* bytes */
+#define NB_PROFILE_SLOTS 8192U
+#define NB_PROFILE_DEPTH 24U
+
+/*
+ * Allocation trace (see nb_trace_dump)
+ *
+ * NB_TRACE: Events kept per thread, the oldest are overwritten; 0 (default)
+ *           leaves the recorder out
+ */
+
+#ifndef NB_TRACE
+        #define NB_TRACE 0U
+#endif
+
+/*
+ * Instrumentation (see nb_stat_histogram)
+ *
+ * NB_INSTRUMENT: Compile the per-thread histograms in; 0 (default) leaves
+ *                them out
+ * NB_HIST_BUCKETS: Bucket i counts values in [2^(i - 1), 2^i); 0 in bucket 0
+ *
+ * Histograms:
+ * NB_HIST_ALLOC_TICKS: Latency of nb_alloc & co.; TSC ticks
+ * NB_HIST_FREE_TICKS: Latency of nb_free; TSC ticks
+ * NB_HIST_SCANNED: Nodes scanned per allocation
+ * NB_HIST_FAILURES: Failed __nb_try_alloc calls per allocation
+ * NB_HIST_RESTARTS: Full rescans (nb_alloc_again) per allocation
+ * NB_HIST_CLIMBED: Ancestor levels climbed per allocation or release
+ */
+
+#ifndef NB_INSTRUMENT
+        #define NB_INSTRUMENT 0
+#endif
+#define NB_HIST_BUCKETS 32U
+
+#define NB_HIST_ALLOC_TICKS 0U
+#define NB_HIST_FREE_TICKS 1U
+#define NB_HIST_SCANNED 2U
+#define NB_HIST_FAILURES 3U
+#define NB_HIST_RESTARTS 4U
+#define NB_HIST_CLIMBED 5U
+#define NB_HISTS 6U
+
+/*
+ * Compaction results (see nb_compact)
+ */
+
+#define NB_COMPACT_DONE 0
+#define NB_COMPACT_FAIL 1
+#define NB_COMPACT_PARTIAL 2
+
+/*
+ * Blocking allocation (see nb_alloc_wait)
+ */
+
+#define NB_WAIT_FOREVER (~0ULL)
+
+/*
+ * Memory hotplug (see nb_offline_region)
+ *
+ * NB_OFFLINE_POLL: Longest sleep between two passes over the range
+ */
+
+#define NB_OFFLINE_POLL 1000000ULL /* nanoseconds */
+
+/*
+ * Allocation flags (see nb_alloc_flags)
+ *
+ * NB_ALLOC_RESERVE: Privileged; may go below the low watermark
+ *
+ * Mobility types; each is steered to its own base level blocks:
+ * NB_ALLOC_MOVABLE: Can be relocated; nb_compact moves only these
+ * NB_ALLOC_RECLAIMABLE: Can be freed on demand (e.g. caches)
+ * NB_ALLOC_UNMOVABLE: Pinned & long-lived
+ */
+
+#define NB_ALLOC_RESERVE 0x1U
+#define NB_ALLOC_MOVABLE 0x2U
+#define NB_ALLOC_RECLAIMABLE 0x4U
+#define NB_ALLOC_UNMOVABLE 0x8U
+#define NB_ALLOC_MOBILITY \
+        (NB_ALLOC_MOVABLE | NB_ALLOC_RECLAIMABLE | NB_ALLOC_UNMOVABLE)
+
+/*
+ * Watermark events (see nb_set_watermark)
+ *
+ * NB_WMARK_LOW: Free memory reached the low watermark, or a block was refused
+ * NB_WMARK_HIGH: Free memory recovered to the high watermark
+ *
+ * Watermarks of every order are bytes of free memory in the whole arena, not
+ * free blocks of that order; the order selects the allocations they gate.
+ */
+
+#define NB_WMARK_LOW 1U
+#define NB_WMARK_HIGH 2U
+
+/*
+ * Placement policies (see nb_set_policy)
+ *
+ * NB_POLICY_FIRST_FIT: Leftmost free block
+ * NB_POLICY_HUGE_PACK: Prefer huge page regions that are already split
+ * NB_POLICY_BEST_FIT: Prefer the smallest free hole; keeps max order blocks
+ * NB_POLICY_PARTITION: Each thread owns a share of the base level blocks &
+ *                      steals from the others once its own is full
+ *
+ * NB_HUGE_SIZE: Huge page size used by NB_POLICY_HUGE_PACK
+ * NB_BEST_FIT_REGIONS: Split max order blocks NB_POLICY_BEST_FIT looks into;
+ *                      each costs a walk of its occupied paths per allocation
+ */
+
+#define NB_POLICY_FIRST_FIT 0U
+#define NB_POLICY_HUGE_PACK 1U
+#define NB_POLICY_BEST_FIT 2U
+#define NB_POLICY_PARTITION 3U
+
+#define NB_HUGE_SIZE (2ULL * 1024 * 1024) /* bytes */
+#define NB_BEST_FIT_REGIONS 64U
+
+/*
+ * NB_SCAN_HINT: Keep the leftmost node that may be free per order in the
+ *               header; scans start from it. Threads share (& write) it, so
+ *               among threads placement isn't strictly leftmost; 0 (default)
+ *               scans every level from its start
+ */
+
+#ifndef NB_SCAN_HINT
+        #define NB_SCAN_HINT 0
+#endif
+
 /*
  * Math functions
  */
@@ -64,32 +317,48 @@ extern "C" {
  * Atomic operations:
  *
  * FAD: Fetch-And-Decrement
+ * FAD_RELAXED: Fetch-And-Decrement; no ordering (statistics & hints)
  * BCAS: Binary-Compare-And-Swap
  * VCAS: Value-Compare-And-Swap
+ * MB_AFTER_RMW: Full barrier after a read-modify-write (e.g. FAD)
+ *
+ * Tree transitions acquire the state they replace & release the new one.
+ * Only the waiter handshake (see nb_alloc_wait) needs sequential consistency.
  */
 
 #if __APPLE__ && __MACH__
         #define FAD(ptr, val) \
                 __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST)
+        #define FAD_RELAXED(ptr, val) \
+                __atomic_add_fetch(ptr, val, __ATOMIC_RELAXED)
         #define BCAS(ptr, expected, desired) \
                 __atomic_compare_exchange_n(ptr, expected, desired, 0, \
-                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
         #define VCAS(ptr, expected, desired) \
                 __atomic_compare_exchange_n(ptr, expected, desired, 0, \
-                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? (*expected) : 0
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ? (*expected) : 0
 #elif __linux__
         #define FAD(ptr, val) \
                 __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST)
+        #define FAD_RELAXED(ptr, val) \
+                __atomic_add_fetch(ptr, val, __ATOMIC_RELAXED)
         #define BCAS(ptr, expected, desired) \
                 __atomic_compare_exchange_n(ptr, expected, desired, 0, \
-                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
         #define VCAS(ptr, expected, desired) \
                 __atomic_compare_exchange_n(ptr, expected, desired, 0, \
-                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? (*expected) : 0
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ? (*expected) : 0
 #else
         #error "Unsupported platform"
 #endif
 
+/* Locked instructions already are full barriers on x86 */
+#if __x86_64__ || __i386__
+        #define MB_AFTER_RMW() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#else
+        #define MB_AFTER_RMW() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
 /*
  * Public APIs
  */
@@ -98,16 +367,126 @@ int  nb_init(uint64_t base_addr, uint64_t size);
 void* nb_alloc(uint64_t size);
 void nb_free(void *addr);
 
+void* nb_alloc_wait(uint64_t size, uint64_t timeout);
+void* nb_alloc_flags(uint64_t size, uint32_t flags);
+void* nb_alloc_colored(uint64_t size, uint32_t color);
+
+#if NB_TAGS
+void* nb_alloc_tagged(uint64_t size, uint16_t tag);
+#endif
+
+#if NB_PROFILE
+void nb_profile_set_rate(uint64_t rate);
+int  nb_profile_dump(int fd);
+#endif
+
+int  nb_set_watermark(uint32_t order, uint64_t low, uint64_t high);
+void nb_set_watermark_callback(
+        void (*callback)(uint32_t order, uint32_t event, void *ctx), void *ctx);
+int  nb_watermark_eventfd();
+
+void nb_free_deferred(void *addr);
+uint64_t nb_reclaim();
+
+void* nb_alloc_zeroed(uint64_t size);
+uint64_t nb_scrub(uint64_t budget);
+
+int  nb_compact(uint32_t order,
+        int (*relocate)(void *dst, void *src, uint64_t size, void *ctx),
+        void *ctx, uint64_t budget);
+
+int  nb_init_mmap(uint64_t size);
+void nb_set_release(uint32_t order, uint64_t interval);
+
+void nb_set_policy(uint32_t policy);
+void nb_set_combining(uint32_t mode);
+
+/*
+ * Memory maps with holes (see nb_init_map)
+ */
+
+struct nb_region {
+        uint64_t base;
+        uint64_t size; /* bytes */
+};
+
+int  nb_init_map(const struct nb_region *regions, uint32_t n);
+int  nb_reserve_range(uint64_t addr, uint64_t size);
+
+int  nb_add_region(uint64_t addr, uint64_t size);
+int  nb_offline_region(uint64_t addr, uint64_t size, uint64_t timeout);
+int  nb_hugepage_advise();
+
+/*
+ * Shared memory & persistent file (see nb_init_shared and nb_open_file)
+ *
+ * Pointers are only meaningful within one process; other processes that
+ * attach to the same segment exchange blocks as offsets into the arena.
+ */
+
+#define NB_INVALID_OFFSET (~0ULL)
+
+int  nb_init_shared(const char *name, uint64_t size);
+int  nb_attach_shared(const char *name);
+
+int  nb_open_file(const char *path, uint64_t size);
+int  nb_close_file();
+
+uint64_t nb_alloc_offset(uint64_t size);
+void nb_free_offset(uint64_t offset);
+void* nb_offset_to_addr(uint64_t offset);
+uint64_t nb_addr_to_offset(void *addr);
+
+/*
+ * Allocation trace (see nb_trace_dump)
+ *
+ * A trace is a header followed by events until the end of the file. Blocks
+ * are offsets into the arena; the events of a thread are in its own order.
+ */
+
+#define NB_TRACE_MAGIC 0x314543415254424eULL /* "NBTRACE1" */
+
+#define NB_TRACE_ALLOC 1U
+#define NB_TRACE_FREE 2U
+
+struct nb_trace_header {
+        uint64_t magic;
+        uint64_t min_size; /* bytes */
+        uint64_t total_memory; /* bytes */
+        uint32_t max_order;
+        uint32_t policy;
+};
+
+struct nb_trace_event {
+        uint64_t ticks; /* TSC; only comparable within one trace */
+        uint64_t size; /* requested bytes; 0 for frees */
+        uint64_t block; /* NB_INVALID_OFFSET if the allocation failed */
+        uint32_t thread;
+        uint16_t op;
+        uint16_t flags;
+};
+
+#if NB_TRACE
+void nb_set_trace(uint8_t enabled);
+int  nb_trace_dump(int fd);
+#endif
+
 /*
  * Private APIs
  */
 
-uint32_t __nb_try_alloc(uint32_t node);
-void __nb_freenode(uint32_t node, uint32_t upper_bound);
-void __nb_unmark(uint32_t node, uint32_t upper_bound);
+nb_node_t __nb_try_alloc(nb_node_t node);
+nb_node_t __nb_scan(nb_node_t start, nb_node_t end);
+void __nb_freenode(nb_node_t node, uint32_t upper_bound);
+void __nb_unmark(nb_node_t node, uint32_t upper_bound);
+
+uint8_t __nb_contended(uint32_t site);
+void __nb_uncontended();
+uint32_t __nb_backoff();
 
-uint32_t __nb_leftmost(uint32_t node, uint32_t depth);
+nb_node_t __nb_leftmost(nb_node_t node, uint32_t depth);
 void __nb_clean_block(void* addr, uint64_t size);
+nb_node_t __nb_free_top(nb_node_t node);
 
 /*
  * Statistics
@@ -125,47 +504,64 @@ uint32_t nb_stat_release_count();
 
 uint64_t nb_stat_total_memory();
 uint64_t nb_stat_used_memory();
+uint64_t nb_stat_committed_memory();
+uint64_t nb_stat_released_memory();
+uint64_t nb_stat_huge_free();
+uint64_t nb_stat_deferred_memory();
 
 uint64_t nb_stat_block_size(uint32_t order);
 uint64_t nb_stat_total_blocks(uint32_t order);
 uint64_t nb_stat_used_blocks(uint32_t order);
+uint64_t nb_stat_free_blocks(uint32_t order);
+uint64_t nb_stat_mobility_regions(uint32_t flags);
+uint64_t nb_stat_cas_failures(uint32_t site);
+uint64_t nb_stat_combined();
+
+#if NB_INSTRUMENT
+int  nb_stat_histogram(uint32_t hist, uint64_t *buckets);
+#endif
+
+#if NB_TAGS
+uint64_t nb_stat_tag_usage(uint16_t tag);
+uint64_t nb_stat_tag_blocks(uint16_t tag);
+#endif
 
 uint8_t nb_stat_occupancy_map(uint8_t *buff, uint32_t order);
 
 /*
  * Helpers
  */
-static inline uint8_t nb_mark(uint8_t val, uint32_t child)
+static inline uint8_t nb_mark(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val | (OCC_LEFT >> (child % 2))));
 }
 
-static inline uint8_t nb_unmark(uint8_t val, uint32_t child)
+static inline uint8_t nb_unmark(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val & ~((OCC_LEFT | COAL_LEFT) >> (child % 2))));
 }
 
-static inline uint8_t nb_set_coal(uint8_t val, uint32_t child)
+static inline uint8_t nb_set_coal(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val | (COAL_LEFT >> (child % 2))));
 }
 
-static inline uint8_t nb_clean_coal(uint8_t val, uint32_t child)
+static inline uint8_t nb_clean_coal(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val & ~(COAL_LEFT >> (child % 2))));
 }
 
-static inline uint8_t nb_is_coal(uint8_t val, uint32_t child)
+static inline uint8_t nb_is_coal(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val & (COAL_LEFT >> (child % 2))));
 }
 
-static inline uint8_t nb_is_occ_buddy(uint8_t val, uint32_t child)
+static inline uint8_t nb_is_occ_buddy(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val & (OCC_RIGHT << (child % 2))));
 }
 
-static inline uint8_t nb_is_coal_buddy(uint8_t val, uint32_t child)
+static inline uint8_t nb_is_coal_buddy(uint8_t val, nb_node_t child)
 {
         return ((uint8_t) (val & (COAL_RIGHT << (child % 2))));
 }
@@ -175,7 +571,7 @@ static inline uint8_t nb_is_free(uint8_t val)
         return !(val & BUSY);
 }
 
-static inline uint32_t nb_level(uint32_t node)
+static inline uint32_t nb_level(nb_node_t node)
 {
         return LOG2_LOWER(node);
 }
@@ -0,0 +1,187 @@
+/*
+ * Non-Blocking Buddy System C++ helpers
+ *
+ * Author: Tuna CICI
+ */
+
+#ifndef NBBS_HPP
+#define NBBS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+        #include "nbbs.h"
+}
+
+/* Longest sleep of the waiter; bounds how late a newcomer is looked at */
+#ifndef NBBS_WAIT_SLICE
+#define NBBS_WAIT_SLICE 1000000ULL /* nanoseconds */
+#endif
+
+namespace nbbs {
+
+struct alloc_awaitable;
+
+/*
+ * Waiter shared by all suspended coroutines
+ *
+ * A single thread retries the pending allocations and sleeps in
+ * nb_alloc_wait() for the smallest of them; a release that fits any of them
+ * wakes it. Coroutines are resumed on this thread, one after the other.
+ */
+class waiter {
+public:
+        static waiter& get()
+        {
+                static waiter instance;
+                return instance;
+        }
+
+        void push(alloc_awaitable *awaitable)
+        {
+                {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        pending.push_back(awaitable);
+                }
+                cv.notify_one();
+        }
+
+private:
+        waiter() : thread([this]() { run(); }) {}
+
+        ~waiter()
+        {
+                {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stop = true;
+                }
+                cv.notify_one();
+                thread.join();
+        }
+
+        inline void run();
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<alloc_awaitable*> pending = {};
+        bool stop = false;
+        std::thread thread; /* last; starts once the rest is set up */
+};
+
+/* Monotonic nanoseconds */
+inline uint64_t clock_ns()
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Awaitable returned by nbbs::alloc()
+ *
+ * Completes immediately if a block is available. Otherwise the coroutine is
+ * suspended and resumed by the waiter once a block is taken for it or the
+ * timeout passes.
+ */
+struct alloc_awaitable {
+        uint64_t size;
+        uint64_t timeout;
+        void *addr = nullptr;
+
+        uint64_t deadline = 0;
+        std::coroutine_handle<> handle = {};
+
+        bool await_ready() noexcept
+        {
+                addr = nb_alloc(size);
+
+                return addr || nb_stat_max_size() < size;
+        }
+
+        void await_suspend(std::coroutine_handle<> suspended)
+        {
+                uint64_t start = clock_ns();
+
+                handle = suspended;
+                deadline = timeout < NB_WAIT_FOREVER - start ?
+                        start + timeout : NB_WAIT_FOREVER;
+                waiter::get().push(this);
+        }
+
+        void* await_resume() noexcept
+        {
+                return addr;
+        }
+};
+
+inline void waiter::run()
+{
+        std::unique_lock<std::mutex> lock(mutex);
+
+        for (;;) {
+                cv.wait(lock, [this]() { return stop || !pending.empty(); });
+                if (stop) {
+                        return;
+                }
+
+                std::vector<alloc_awaitable*> left = {};
+                left.swap(pending);
+                lock.unlock();
+
+                std::vector<alloc_awaitable*> ready = {};
+                uint64_t start = clock_ns();
+
+                for (auto it = left.begin(); it != left.end(); ) {
+                        alloc_awaitable *a = *it;
+
+                        a->addr = nb_alloc(a->size);
+                        if (a->addr || a->deadline <= start) {
+                                ready.push_back(a);
+                                it = left.erase(it);
+                        } else {
+                                ++it;
+                        }
+                }
+
+                /* Sleep until a release, the first deadline or the slice */
+                if (ready.empty()) {
+                        auto smallest = std::min_element(left.begin(),
+                                left.end(), [](auto *a, auto *b) {
+                                        return a->size < b->size;
+                                });
+                        uint64_t sleep = NBBS_WAIT_SLICE;
+                        for (alloc_awaitable *a : left) {
+                                sleep = std::min(sleep, a->deadline - start);
+                        }
+
+                        (*smallest)->addr = nb_alloc_wait((*smallest)->size,
+                                sleep);
+                        if ((*smallest)->addr) {
+                                ready.push_back(*smallest);
+                                left.erase(smallest);
+                        }
+                }
+
+                for (alloc_awaitable *a : ready) {
+                        a->handle.resume();
+                }
+
+                lock.lock();
+                pending.insert(pending.end(), left.begin(), left.end());
+        }
+}
+
+/* co_await nbbs::alloc(size) */
+inline alloc_awaitable alloc(uint64_t size, uint64_t timeout = NB_WAIT_FOREVER)
+{
+        return alloc_awaitable{size, timeout};
+}
+
+} /* namespace nbbs */
+
+#endif /* NBBS_HPP */